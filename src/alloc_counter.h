@@ -0,0 +1,11 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+// Global operator new calls made by this process so far. The counting
+// replacements live in alloc_counter.cpp; they let a propagation run report
+// how many heap allocations it made.
+uint64_t heap_allocations();
+
+#endif // ALLOC_COUNTER_H
@@ -1,249 +1,788 @@
 #include "bgp_simulator.h"
+#include "file_input.h"
+#include "alloc_counter.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-#include <queue>
 #include <functional>
+#include <iterator>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 // Route Implementation
-Route::Route(const std::string& prefix, const std::vector<int>& as_path, 
+Route::Route(uint32_t prefix_id, int origin_asn,
              AnnouncementType type, bool rov_invalid)
-    : prefix(prefix), as_path(as_path), announcement_type(type), rov_invalid(rov_invalid) {}
+    : prefix_id(prefix_id), asn(origin_asn), parent(nullptr), path_signature(asn_signature(origin_asn)),
+      path_length(1), announcement_type(type), rov_invalid(rov_invalid) {}
+
+Route::Route(const Route* parent, int asn, AnnouncementType type)
+    : prefix_id(parent->prefix_id), asn(asn), parent(parent),
+      path_signature(parent->path_signature | asn_signature(asn)), path_length(parent->path_length + 1),
+      announcement_type(type), rov_invalid(parent->rov_invalid) {}
 
 int Route::get_origin_asn() const {
-    return as_path.empty() ? -1 : as_path.back();
+    const Route* node = this;
+    while (node->parent) {
+        node = node->parent;
+    }
+    return node->asn;
 }
 
-void Route::prepend(int asn) {
-    as_path.insert(as_path.begin(), asn);
+bool Route::path_contains(int asn) const {
+    uint64_t bits = asn_signature(asn);
+    if ((path_signature & bits) != bits) {
+        return false;
+    }
+    for (const Route* node = this; node != nullptr; node = node->parent) {
+        if (node->asn == asn) {
+            return true;
+        }
+    }
+    return false;
 }
 
-Route Route::copy() const {
-    return Route(prefix, as_path, announcement_type, rov_invalid);
+void RouteArena::next_block() {
+    if (!blocks.empty()) {
+        current++;
+    }
+    if (current == blocks.size()) {
+        if (blocks.size() == blocks.capacity()) {
+            block_allocations++;   // the block table itself grows
+        }
+        blocks.emplace_back();
+        blocks.back().reserve(BLOCK_ROUTES);
+        block_allocations++;
+    }
 }
 
+
 // ASGraph Implementation
-void ASGraph::add_relationship(int asn1, int asn2, RelationType rel_type) {
-    adjacency[asn1].push_back({asn2, rel_type});
-    
-    RelationType reverse_rel = RelationType::PEER_TO_PEER;
+static RelationType reverse_relationship(RelationType rel_type) {
     switch (rel_type) {
         case RelationType::PROVIDER_TO_CUSTOMER:
-            reverse_rel = RelationType::CUSTOMER_TO_PROVIDER;
-            break;
+            return RelationType::CUSTOMER_TO_PROVIDER;
         case RelationType::CUSTOMER_TO_PROVIDER:
-            reverse_rel = RelationType::PROVIDER_TO_CUSTOMER;
-            break;
+            return RelationType::PROVIDER_TO_CUSTOMER;
         case RelationType::PEER_TO_PEER:
-            reverse_rel = RelationType::PEER_TO_PEER;
-            break;
+            return RelationType::PEER_TO_PEER;
+    }
+    return RelationType::PEER_TO_PEER;
+}
+
+int ASGraph::index_of(int asn) const {
+    auto it = asn_to_index.find(asn);
+    return it == asn_to_index.end() ? -1 : it->second;
+}
+
+int ASGraph::add_asn(int asn) {
+    auto [it, inserted] = asn_to_index.emplace(asn, static_cast<int>(index_to_asn.size()));
+    if (inserted) {
+        index_to_asn.push_back(asn);
+        // A new AS starts with three empty neighbor ranges
+        offsets.insert(offsets.end(), 3, offsets.back());
+        ranks_valid = false;
     }
-    adjacency[asn2].push_back({asn1, reverse_rel});
+    return it->second;
+}
+
+void ASGraph::add_relationship(int asn1, int asn2, RelationType rel_type) {
+    int index1 = add_asn(asn1);
+    int index2 = add_asn(asn2);
+    pending_edges.push_back({index1, index2, rel_type});
+    pending_edges.push_back({index2, index1, reverse_relationship(rel_type)});
     
-    all_asns.insert(asn1);
-    all_asns.insert(asn2);
+    ranks_valid = false;
 }
 
-void ASGraph::load_from_file(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open file: " + filename);
+void ASGraph::finalize() {
+    if (pending_edges.empty()) {
+        return;
+    }
+    
+    // Counting sort by (source AS, relationship)
+    size_t num_ranges = 3 * num_ases();
+    auto range_of = [](const PendingEdge& edge) {
+        return 3 * edge.from + static_cast<int>(edge.rel_type);
+    };
+    
+    std::vector<uint32_t> new_offsets(num_ranges + 1, 0);
+    for (size_t r = 0; r < num_ranges; r++) {
+        new_offsets[r + 1] = offsets[r + 1] - offsets[r];
+    }
+    for (const auto& edge : pending_edges) {
+        new_offsets[range_of(edge) + 1]++;
+    }
+    for (size_t r = 0; r < num_ranges; r++) {
+        new_offsets[r + 1] += new_offsets[r];
     }
+    
+    std::vector<int> new_neighbors(new_offsets[num_ranges]);
+    std::vector<uint32_t> fill(new_offsets.begin(), new_offsets.end() - 1);
+    for (size_t r = 0; r < num_ranges; r++) {
+        for (uint32_t e = offsets[r]; e < offsets[r + 1]; e++) {
+            new_neighbors[fill[r]++] = neighbors[e];
+        }
+    }
+    for (const auto& edge : pending_edges) {
+        new_neighbors[fill[range_of(edge)]++] = edge.to;
+    }
+    
+    // Canonical order: each range sorted by neighbor ASN
+    auto by_asn = [&](int a, int b) { return index_to_asn[a] < index_to_asn[b]; };
+    for (size_t r = 0; r < num_ranges; r++) {
+        std::sort(new_neighbors.begin() + new_offsets[r], new_neighbors.begin() + new_offsets[r + 1], by_asn);
+    }
+    
+    offsets = std::move(new_offsets);
+    neighbors = std::move(new_neighbors);
+    pending_edges.clear();
+    pending_edges.shrink_to_fit();
+}
 
-    std::string line;
-    int relationships_loaded = 0;
+namespace {
 
-    while (std::getline(file, line)) {
-        if (line.empty() || line[0] == '#') continue;
+inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    return p;
+}
+
+// Parses one integer field of a CAIDA line and consumes the '|' (or blank)
+// separator that follows it.
+inline bool parse_field(const char*& p, const char* end, int& value) {
+    p = skip_blanks(p, end);
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        return false;
+    }
+    p = result.ptr;
+    if (p < end && *p != '|' && *p != ' ' && *p != '\t' && *p != '\r') {
+        return false;
+    }
+    if (p < end && *p == '|') ++p;
+    return true;
+}
 
-        // CAIDA-style: fields separated by '|'
-        std::replace(line.begin(), line.end(), '|', ' ');
+// CAIDA serial-2 line: asn1|asn2|rel[|source]. The trailing source label is ignored.
+bool parse_relationship_line(const char* p, const char* end,
+                             int& asn1, int& asn2, int& rel_type_int) {
+    return parse_field(p, end, asn1) &&
+           parse_field(p, end, asn2) &&
+           parse_field(p, end, rel_type_int);
+}
 
-        std::istringstream iss(line);
-        int asn1, asn2, rel_type_int;
-        std::string bgp_label;  // trailing field, can ignore
+// Parses every relationship line in [p, end) into out, in file order.
+void parse_relationship_chunk(const char* p, const char* end,
+                              std::vector<Relationship>& out) {
+    while (p < end) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (eol == nullptr) eol = end;
+        const char* line = p;
+        p = eol + 1;
+
+        if (line == eol || *line == '#') continue;
 
-        if (!(iss >> asn1 >> asn2 >> rel_type_int)) {
+        int asn1, asn2, rel_type_int;
+        if (!parse_relationship_line(line, eol, asn1, asn2, rel_type_int)) {
             continue;
         }
-        // If there is a fourth field, eat it so we don't care
-        iss >> bgp_label;
 
-        RelationType rel_type;
         if (rel_type_int == -1) {
             // asn1 is PROVIDER of asn2
-            rel_type = RelationType::PROVIDER_TO_CUSTOMER;
+            out.push_back({asn1, asn2, RelationType::PROVIDER_TO_CUSTOMER});
         } else if (rel_type_int == 0) {
             // peers
-            rel_type = RelationType::PEER_TO_PEER;
-        } else {
-            // ignore special/unknown rels
-            continue;
+            out.push_back({asn1, asn2, RelationType::PEER_TO_PEER});
         }
+        // ignore special/unknown rels
+    }
+}
 
-        add_relationship(asn1, asn2, rel_type);
-        relationships_loaded++;
+// Below this many bytes per worker, thread startup costs more than it saves.
+constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+// Parses a plain relationship file on up to num_threads workers, one
+// newline-aligned chunk each (0 = one per core)
+std::vector<std::vector<Relationship>> parse_relationship_file(const std::string& filename,
+                                                               unsigned num_threads) {
+    MappedFile file(filename);
+
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
     }
+    size_t max_chunks = std::max<size_t>(1, file.size() / MIN_CHUNK_BYTES);
+    size_t num_chunks = std::min<size_t>(num_threads, max_chunks);
 
-    std::cout << "Loaded " << relationships_loaded
-              << " relationships for " << all_asns.size() << " ASNs\n";
+    // Split on line boundaries so no line straddles two chunks
+    std::vector<const char*> bounds{file.begin()};
+    for (size_t i = 1; i < num_chunks; i++) {
+        const char* cut = file.begin() + file.size() * i / num_chunks;
+        if (cut < bounds.back()) cut = bounds.back();
+        const char* eol = static_cast<const char*>(std::memchr(cut, '\n', file.end() - cut));
+        bounds.push_back(eol == nullptr ? file.end() : eol + 1);
+    }
+    bounds.push_back(file.end());
+
+    std::vector<std::vector<Relationship>> chunks(num_chunks);
+    if (num_chunks == 1) {
+        parse_relationship_chunk(bounds[0], bounds[1], chunks[0]);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < num_chunks; i++) {
+            workers.emplace_back(parse_relationship_chunk, bounds[i], bounds[i + 1],
+                                 std::ref(chunks[i]));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    return chunks;
+}
+
+const char* relationship_name(const Relationship& rel) {
+    return rel.rel_type == RelationType::PEER_TO_PEER ? "peers" : "provider-customer";
 }
 
-std::vector<std::pair<int, RelationType>> ASGraph::get_neighbors(int asn) const {
-    auto it = adjacency.find(asn);
-    if (it != adjacency.end()) {
-        return it->second;
+// Puts relationships in canonical form (peers listed lower ASN first), sorts
+// them and removes exact duplicates, returning how many were removed. AS pairs
+// listed with more than one distinct relationship are kept as-is but reported,
+// since picking one silently would hide a broken input.
+size_t canonicalize_relationships(std::vector<Relationship>& relationships) {
+    for (auto& rel : relationships) {
+        if (rel.rel_type == RelationType::PEER_TO_PEER && rel.asn1 > rel.asn2) {
+            std::swap(rel.asn1, rel.asn2);
+        }
+    }
+    std::sort(relationships.begin(), relationships.end());
+    size_t before = relationships.size();
+    relationships.erase(std::unique(relationships.begin(), relationships.end()), relationships.end());
+
+    // Group by unordered AS pair to find conflicts
+    std::vector<std::pair<std::pair<int, int>, size_t>> pairs;
+    pairs.reserve(relationships.size());
+    for (size_t i = 0; i < relationships.size(); i++) {
+        const auto& rel = relationships[i];
+        pairs.push_back({{std::min(rel.asn1, rel.asn2), std::max(rel.asn1, rel.asn2)}, i});
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    constexpr size_t MAX_REPORTED = 10;
+    size_t conflicts = 0;
+    for (size_t i = 0; i < pairs.size();) {
+        size_t j = i + 1;
+        while (j < pairs.size() && pairs[j].first == pairs[i].first) j++;
+        if (j - i > 1 && conflicts++ < MAX_REPORTED) {
+            std::cerr << "Warning: conflicting relationships for AS " << pairs[i].first.first
+                      << " and AS " << pairs[i].first.second << ":";
+            for (size_t k = i; k < j; k++) {
+                const auto& rel = relationships[pairs[k].second];
+                std::cerr << " " << rel.asn1 << "|" << rel.asn2 << " (" << relationship_name(rel) << ")";
+            }
+            std::cerr << "\n";
+        }
+        i = j;
+    }
+    if (conflicts > 0) {
+        std::cerr << "Warning: " << conflicts << " AS pairs have conflicting relationships\n";
+    }
+
+    return before - relationships.size();
+}
+
+} // namespace
+
+void ASGraph::load_from_file(const std::string& filename, unsigned num_threads) {
+    std::vector<std::vector<Relationship>> chunks;
+    if (is_compressed_file(filename)) {
+        // Streamed: blocks are parsed while the next ones are being inflated
+        chunks.emplace_back();
+        for_each_line_block(filename, [&](const char* begin, const char* end) {
+            parse_relationship_chunk(begin, end, chunks[0]);
+        });
+    } else {
+        chunks = parse_relationship_file(filename, num_threads);
+    }
+
+    int relationships_loaded = 0;
+    for (const auto& chunk : chunks) {
+        relationships_loaded += chunk.size();
+    }
+    std::vector<Relationship> relationships;
+    relationships.reserve(relationships_loaded);
+    for (auto& chunk : chunks) {
+        relationships.insert(relationships.end(), chunk.begin(), chunk.end());
+        std::vector<Relationship>().swap(chunk);
+    }
+    size_t duplicates = canonicalize_relationships(relationships);
+
+    // A fresh graph numbers its ASes by ascending ASN, so ASN order and
+    // index order agree when walking neighbor ranges
+    if (num_ases() == 0) {
+        std::vector<int> asns;
+        asns.reserve(2 * relationships.size());
+        for (const auto& rel : relationships) {
+            asns.push_back(rel.asn1);
+            asns.push_back(rel.asn2);
+        }
+        std::sort(asns.begin(), asns.end());
+        asns.erase(std::unique(asns.begin(), asns.end()), asns.end());
+        index_to_asn.reserve(asns.size());
+        offsets.reserve(3 * asns.size() + 1);
+        asn_to_index.reserve(asns.size());
+        for (int asn : asns) {
+            add_asn(asn);
+        }
+    }
+
+    pending_edges.reserve(pending_edges.size() + 2 * relationships.size());
+    for (const auto& rel : relationships) {
+        add_relationship(rel.asn1, rel.asn2, rel.rel_type);
+    }
+    finalize();
+
+    std::cout << "Loaded " << relationships_loaded
+              << " relationships for " << num_ases() << " ASNs\n";
+    if (duplicates > 0) {
+        std::cout << "Dropped " << duplicates << " duplicate relationships\n";
     }
-    return {};
 }
 
 void ASGraph::print_stats() const {
     int customer_relationships = 0, peer_relationships = 0, provider_relationships = 0;
     
-    for (const auto& asn_entry : adjacency) {
-        for (const auto& neighbor : asn_entry.second) {
-            switch (neighbor.second) {
-                case RelationType::CUSTOMER_TO_PROVIDER:
-                    customer_relationships++;
-                    break;
-                case RelationType::PEER_TO_PEER:
-                    peer_relationships++;
-                    break;
-                case RelationType::PROVIDER_TO_CUSTOMER:
-                    provider_relationships++;
-                    break;
-            }
-        }
+    for (int u = 0; u < static_cast<int>(num_ases()); u++) {
+        provider_relationships += customers_of(u).size();
+        peer_relationships += peers_of(u).size();
+        customer_relationships += providers_of(u).size();
     }
     
-    std::cout << "Graph stats - ASNs: " << all_asns.size() 
+    std::cout << "Graph stats - ASNs: " << num_ases() 
               << ", Customer rels: " << customer_relationships 
               << ", Peer rels: " << peer_relationships 
               << ", Provider rels: " << provider_relationships << "\n";
 }
 
 bool ASGraph::has_customer_provider_cycle() const {
-    enum class Color { WHITE, GRAY, BLACK };
+    return !customer_provider_cycles().empty();
+}
 
-    // Initialize all nodes as unvisited (WHITE)
-    std::unordered_map<int, Color> color;
-    for (int asn : all_asns) {
-        color[asn] = Color::WHITE;
+std::vector<std::vector<int>> ASGraph::customer_provider_cycles() const {
+    // Iterative Tarjan over customer -> provider edges. An explicit call stack
+    // keeps arbitrarily deep hierarchies off the machine stack.
+    int n = static_cast<int>(num_ases());
+    std::vector<int> order(n, -1);   // discovery order, -1 = unvisited
+    std::vector<int> low(n, 0);
+    std::vector<char> on_stack(n, 0);
+    std::vector<int> component_stack;
+    
+    struct Frame {
+        int node;
+        const int* next_provider;
+    };
+    std::vector<Frame> call_stack;
+    int counter = 0;
+    std::vector<std::vector<int>> cycles;
+    
+    auto visit = [&](int u) {
+        order[u] = low[u] = counter++;
+        component_stack.push_back(u);
+        on_stack[u] = 1;
+        call_stack.push_back({u, providers_of(u).begin()});
+    };
+    
+    for (int root = 0; root < n; root++) {
+        if (order[root] >= 0) continue;
+        visit(root);
+        
+        while (!call_stack.empty()) {
+            int u = call_stack.back().node;
+            const int* providers_end = providers_of(u).end();
+            
+            if (call_stack.back().next_provider != providers_end) {
+                int v = *call_stack.back().next_provider++;
+                if (order[v] < 0) {
+                    visit(v);
+                } else if (on_stack[v]) {
+                    low[u] = std::min(low[u], order[v]);
+                }
+                continue;
+            }
+            
+            call_stack.pop_back();
+            if (!call_stack.empty()) {
+                int parent = call_stack.back().node;
+                low[parent] = std::min(low[parent], low[u]);
+            }
+            if (low[u] != order[u]) continue;
+            
+            // u roots a component: pop it and keep it if it contains a cycle
+            std::vector<int> component;
+            int w;
+            do {
+                w = component_stack.back();
+                component_stack.pop_back();
+                on_stack[w] = 0;
+                component.push_back(index_to_asn[w]);
+            } while (w != u);
+            
+            auto providers = providers_of(u);
+            bool self_loop = std::find(providers.begin(), providers.end(), u) != providers.end();
+            if (component.size() > 1 || self_loop) {
+                std::sort(component.begin(), component.end());
+                cycles.push_back(std::move(component));
+            }
+        }
     }
+    
+    std::sort(cycles.begin(), cycles.end());
+    return cycles;
+}
 
-    // DFS following ONLY customer -> provider edges
-    std::function<bool(int)> dfs = [&](int u) -> bool {
-        color[u] = Color::GRAY;
+namespace {
 
-        auto it = adjacency.find(u);
-        if (it != adjacency.end()) {
-            for (const auto& neighbor : it->second) {
-                int v = neighbor.first;
-                RelationType rel = neighbor.second;
+// Below this many ASes per worker a rank is cheaper to release serially.
+constexpr size_t MIN_RANK_SLICE = 1 << 14;
 
-                // We want directed edges: u --CUSTOMER_TO_PROVIDER--> v
-                if (rel != RelationType::CUSTOMER_TO_PROVIDER) {
-                    continue;
-                }
+} // namespace
 
-                if (color[v] == Color::GRAY) {
-                    // Back edge → cycle
-                    return true;
-                }
-                if (color[v] == Color::WHITE && dfs(v)) {
-                    return true;
+std::vector<std::vector<int>> ASGraph::compute_ranks(unsigned num_threads) {
+    finalize();
+    
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t n = num_ases();
+    std::unique_ptr<std::atomic<int>[]> customer_count(new std::atomic<int>[n]);
+    for (size_t u = 0; u < n; u++) {
+        customer_count[u].store(customers_of(u).size(), std::memory_order_relaxed);
+    }
+    
+    // ranked_asns doubles as the Kahn frontier: each rank is appended whole
+    // before the next one is released
+    ranked_asns.clear();
+    ranked_asns.reserve(n);
+    rank_offsets.assign(1, 0);
+    index_to_rank.assign(n, -1);
+    for (size_t u = 0; u < n; u++) {
+        if (customer_count[u].load(std::memory_order_relaxed) == 0) {
+            ranked_asns.push_back(u);
+        }
+    }
+    
+    // Stamps ranked_asns[first, last) with rank and collects the providers
+    // whose last unranked customer was among them. Workers touch disjoint
+    // slices; the atomic decrement hands each provider to exactly one of them.
+    auto release = [&](size_t first, size_t last, int rank, std::vector<int>& next) {
+        for (size_t i = first; i < last; i++) {
+            int u = ranked_asns[i];
+            index_to_rank[u] = rank;
+            for (int provider : providers_of(u)) {
+                if (customer_count[provider].fetch_sub(1, std::memory_order_relaxed) == 1) {
+                    next.push_back(provider);
                 }
             }
         }
-
-        color[u] = Color::BLACK;
-        return false;
     };
+    
+    size_t level_begin = 0;
+    while (level_begin < ranked_asns.size()) {
+        size_t level_end = ranked_asns.size();
+        size_t level_size = level_end - level_begin;
+        int current_rank = rank_offsets.size() - 1;
+        
+        size_t num_workers = std::min<size_t>(num_threads, std::max<size_t>(1, level_size / MIN_RANK_SLICE));
+        std::vector<std::vector<int>> next(num_workers);
+        if (num_workers == 1) {
+            release(level_begin, level_end, current_rank, next[0]);
+        } else {
+            std::vector<std::thread> workers;
+            for (size_t w = 0; w < num_workers; w++) {
+                workers.emplace_back(release,
+                                     level_begin + level_size * w / num_workers,
+                                     level_begin + level_size * (w + 1) / num_workers,
+                                     current_rank, std::ref(next[w]));
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+        
+        for (const auto& part : next) {
+            ranked_asns.insert(ranked_asns.end(), part.begin(), part.end());
+        }
+        std::sort(ranked_asns.begin() + level_end, ranked_asns.end());
+        rank_offsets.push_back(level_end);
+        level_begin = level_end;
+    }
+    size_t ranked = ranked_asns.size();
+    
+    // Anything Kahn could not rank sits on or above a cycle; only then is the
+    // SCC pass needed to name the offending ASes
+    if (ranked < n) {
+        ranks_valid = false;
+        return customer_provider_cycles();
+    }
+    ranks_valid = true;
+    return {};
+}
 
-    // Run DFS from every unvisited node
-    for (int asn : all_asns) {
-        if (color[asn] == Color::WHITE) {
-            if (dfs(asn)) {
-                return true;
+std::vector<Relationship> ASGraph::relationships() const {
+    std::vector<Relationship> result;
+    for (int u = 0; u < static_cast<int>(num_ases()); u++) {
+        int asn = index_to_asn[u];
+        for (int customer : customers_of(u)) {
+            result.push_back({asn, index_to_asn[customer], RelationType::PROVIDER_TO_CUSTOMER});
+        }
+        // Each peering is stored at both ends; report it from the lower ASN
+        for (int peer : peers_of(u)) {
+            if (asn < index_to_asn[peer]) {
+                result.push_back({asn, index_to_asn[peer], RelationType::PEER_TO_PEER});
             }
         }
     }
+    std::sort(result.begin(), result.end());
+    return result;
+}
 
-    return false;
+TopologyDiff ASGraph::diff_to(const ASGraph& next) const {
+    std::vector<Relationship> before = relationships();
+    std::vector<Relationship> after = next.relationships();
+    
+    TopologyDiff diff;
+    std::set_difference(after.begin(), after.end(), before.begin(), before.end(),
+                        std::back_inserter(diff.added));
+    std::set_difference(before.begin(), before.end(), after.begin(), after.end(),
+                        std::back_inserter(diff.removed));
+    return diff;
 }
 
+void ASGraph::apply_diff(const TopologyDiff& diff) {
+    finalize();
+    
+    // Directed CSR entries to drop, keyed by (from, to, relationship)
+    auto key = [](int from, int to, int rel) {
+        return (static_cast<uint64_t>(from) << 34) | (static_cast<uint64_t>(to) << 2) | rel;
+    };
+    std::unordered_map<uint64_t, int> doomed;
+    for (const auto& rel : diff.removed) {
+        int index1 = index_of(rel.asn1);
+        int index2 = index_of(rel.asn2);
+        if (index1 < 0 || index2 < 0) continue;
+        doomed[key(index1, index2, static_cast<int>(rel.rel_type))]++;
+        doomed[key(index2, index1, static_cast<int>(reverse_relationship(rel.rel_type)))]++;
+    }
+    
+    if (!doomed.empty()) {
+        size_t num_ranges = 3 * num_ases();
+        std::vector<uint32_t> kept_offsets(num_ranges + 1, 0);
+        std::vector<int> kept;
+        kept.reserve(neighbors.size());
+        for (size_t r = 0; r < num_ranges; r++) {
+            int from = r / 3;
+            for (uint32_t e = offsets[r]; e < offsets[r + 1]; e++) {
+                auto it = doomed.find(key(from, neighbors[e], r % 3));
+                if (it != doomed.end() && it->second > 0) {
+                    it->second--;
+                    continue;
+                }
+                kept.push_back(neighbors[e]);
+            }
+            kept_offsets[r + 1] = kept.size();
+        }
+        offsets = std::move(kept_offsets);
+        neighbors = std::move(kept);
+        ranks_valid = false;
+    }
+    
+    for (const auto& rel : diff.added) {
+        add_relationship(rel.asn1, rel.asn2, rel.rel_type);
+    }
+    finalize();
+}
+
+namespace {
+
+// Reusable barrier for the rank-parallel workers (std::barrier is C++20)
+class Barrier {
+public:
+    explicit Barrier(unsigned count) : count(count) {}
+    
+    void arrive_and_wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        unsigned arrival_generation = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            generation++;
+            released.notify_all();
+            return;
+        }
+        released.wait(lock, [&] { return generation != arrival_generation; });
+    }
+    
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    unsigned count;
+    unsigned waiting = 0;
+    unsigned generation = 0;
+};
+
+} // namespace
+
+// What rank-parallel workers share besides the RIBs: the barrier between
+// ranks and a slot per worker for summing counts
+struct BGPSimulator::RankSync {
+    explicit RankSync(unsigned num_workers) : barrier(num_workers), worker_values(num_workers, 0) {}
+    
+    Barrier barrier;
+    std::vector<int> worker_values;
+};
+
 // BGPSimulator Implementation
-BGPSimulator::BGPSimulator(ASGraph& graph) : graph(graph) {}
+BGPSimulator::BGPSimulator(ASGraph& graph) : graph(graph), arenas(1) {
+    graph.finalize();
+}
 
 void BGPSimulator::set_rov_asns(const std::unordered_set<int>& rov_asns) {
     rov_enabled_asns = rov_asns;
 }
 
+void BGPSimulator::set_threads(unsigned threads) {
+    num_threads = threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads;
+}
+
 void BGPSimulator::seed_announcement(int origin_asn, const std::string& prefix, bool rov_invalid) {
-    graph.all_asns.insert(origin_asn);
-    
-    auto route = std::make_shared<Route>(prefix, std::vector<int>{origin_asn}, 
-                                        AnnouncementType::LEARNED_FROM_CUSTOMER, rov_invalid);
-    ribs[origin_asn][prefix] = route;
+    announcements.push_back({origin_asn, prefix, rov_invalid});
+    install_seed(announcements.back());
     
     std::cout << "Seeded: AS " << origin_asn << " -> " << prefix;
     if (rov_invalid) std::cout << " (ROV INVALID)";
     std::cout << "\n";
 }
 
-void BGPSimulator::flatten_graph() {
-    asn_to_rank.clear();
-    rank_to_asns.clear();
+void BGPSimulator::seed_announcements(const std::vector<Announcement>& batch) {
+    std::vector<int> origins;
+    std::vector<uint32_t> prefix_ids;
+    origins.reserve(batch.size());
+    prefix_ids.reserve(batch.size());
+    for (const auto& announcement : batch) {
+        origins.push_back(graph.add_asn(announcement.origin_asn));
+        prefix_ids.push_back(prefixes.intern(announcement.prefix));
+    }
     
-    std::cout << "Flattening graph with " << graph.all_asns.size() << " ASNs...\n";
+    // Size the arrays once for the whole batch, then fill them in place
+    resize_ribs();
+    for (size_t i = 0; i < batch.size(); i++) {
+        install_seed(origins[i], prefix_ids[i], batch[i]);
+    }
+    announcements.insert(announcements.end(), batch.begin(), batch.end());
+    std::cout << "Seeded " << batch.size() << " announcements\n";
+}
+
+void BGPSimulator::install_seed(const Announcement& announcement) {
+    int origin = graph.add_asn(announcement.origin_asn);
+    uint32_t prefix_id = prefixes.intern(announcement.prefix);
+    resize_ribs();
+    install_seed(origin, prefix_id, announcement);
+}
+
+void BGPSimulator::install_seed(int origin, uint32_t prefix_id, const Announcement& announcement) {
+    RibEntry& entry = ribs[prefix_id][origin];
+    route_count += !entry.valid();
+    entry.route = arenas.front().create(prefix_id, announcement.origin_asn,
+                                AnnouncementType::LEARNED_FROM_CUSTOMER, announcement.rov_invalid);
+    entry.next_hop_asn = announcement.origin_asn;
+    entry.path_length = 1;
+    entry.announcement_type = AnnouncementType::LEARNED_FROM_CUSTOMER;
+    entry.flags = RibEntry::VALID | (announcement.rov_invalid ? RibEntry::ROV_INVALID : 0);
+}
+
+void BGPSimulator::compact_routes() {
+    std::vector<RouteArena> compacted(1);
+    RouteArena& routes = compacted.front();
+    std::unordered_map<const Route*, const Route*> moved;
+    moved.reserve(route_count);
+    std::vector<const Route*> chain;
     
-    std::unordered_map<int, int> customer_count;
-    for (int asn : graph.all_asns) {
-        customer_count[asn] = 0;
-        for (const auto& neighbor : graph.get_neighbors(asn)) {
-            if (neighbor.second == RelationType::PROVIDER_TO_CUSTOMER) {
-                customer_count[asn]++;
+    // Copies route and any ancestors not yet moved, root first, so each copy
+    // can point at its parent's copy
+    auto move_route = [&](const Route* route) {
+        chain.clear();
+        auto found = moved.end();
+        for (const Route* node = route; node != nullptr; node = node->parent) {
+            found = moved.find(node);
+            if (found != moved.end()) break;
+            chain.push_back(node);
+        }
+        const Route* parent = found != moved.end() ? found->second : nullptr;
+        for (auto node = chain.rbegin(); node != chain.rend(); ++node) {
+            const Route* copy = parent
+                ? routes.create(parent, (*node)->asn, (*node)->announcement_type)
+                : routes.create((*node)->prefix_id, (*node)->asn, (*node)->announcement_type,
+                                (*node)->rov_invalid);
+            moved.emplace(*node, copy);
+            parent = copy;
+        }
+        return moved.find(route)->second;
+    };
+    
+    for (auto& rib : ribs) {
+        for (RibEntry& entry : rib) {
+            if (entry.valid()) {
+                entry.route = move_route(entry.route);
             }
         }
     }
+    arenas = std::move(compacted);
+}
+
+// Gives every interned prefix a RIB slot for every AS
+void BGPSimulator::resize_ribs() {
+    size_t num_ases = graph.num_ases();
+    if (ribs.size() == prefixes.size() && (ribs.empty() || ribs.front().size() == num_ases)) {
+        return;
+    }
+    ribs.resize(prefixes.size());
+    for (auto& rib : ribs) {
+        rib.resize(num_ases);
+    }
+}
+
+void BGPSimulator::sync_with_graph() {
+    graph.finalize();
+    resize_ribs();
     
-    std::queue<int> zero_customer_queue;
-    for (const auto& entry : customer_count) {
-        if (entry.second == 0) {
-            zero_customer_queue.push(entry.first);
+    rov_enabled.assign(graph.num_ases(), 0);
+    for (int asn : rov_enabled_asns) {
+        int index = graph.index_of(asn);
+        if (index >= 0) {
+            rov_enabled[index] = 1;
         }
     }
+}
+
+bool BGPSimulator::flatten_graph() {
+    if (graph.ranks_valid) {
+        std::cout << "Reusing cached hierarchy of " << graph.num_ranks() << " ranks\n";
+        return true;
+    }
     
-    int current_rank = 0;
-    while (!zero_customer_queue.empty()) {
-        int level_size = zero_customer_queue.size();
-        rank_to_asns.push_back(std::vector<int>());
-        
-        for (int i = 0; i < level_size; i++) {
-            int asn = zero_customer_queue.front();
-            zero_customer_queue.pop();
-            
-            asn_to_rank[asn] = current_rank;
-            rank_to_asns[current_rank].push_back(asn);
-            
-            for (const auto& neighbor : graph.get_neighbors(asn)) {
-                if (neighbor.second == RelationType::CUSTOMER_TO_PROVIDER) {
-                    customer_count[neighbor.first]--;
-                    if (customer_count[neighbor.first] == 0) {
-                        zero_customer_queue.push(neighbor.first);
-                    }
-                }
-            }
-        }
-        current_rank++;
+    std::cout << "Flattening graph with " << graph.num_ases() << " ASNs...\n";
+    if (!graph.compute_ranks().empty()) {
+        return false;
     }
     
-    std::cout << "Found " << rank_to_asns[0].size() << " rank-0 ASNs\n";
-    std::cout << "Graph flattened into " << rank_to_asns.size() << " ranks\n";
-    for (size_t i = 0; i < rank_to_asns.size(); i++) {
-        std::cout << "  Rank " << i << ": " << rank_to_asns[i].size() << " ASNs\n";
+    std::cout << "Found " << (graph.num_ranks() ? graph.rank_members(0).size() : 0) << " rank-0 ASNs\n";
+    std::cout << "Graph flattened into " << graph.num_ranks() << " ranks\n";
+    for (size_t i = 0; i < graph.num_ranks(); i++) {
+        std::cout << "  Rank " << i << ": " << graph.rank_members(i).size() << " ASNs\n";
     }
+    return true;
 }
 
 AnnouncementType BGPSimulator::relationship_to_announcement_type(RelationType rel_type) const {
@@ -258,8 +797,8 @@ AnnouncementType BGPSimulator::relationship_to_announcement_type(RelationType re
     return AnnouncementType::LEARNED_FROM_PROVIDER;
 }
 
-bool BGPSimulator::can_export(const Route& route, RelationType export_relationship) const {
-    switch (route.announcement_type) {
+bool BGPSimulator::can_export(AnnouncementType learned_from, RelationType export_relationship) const {
+    switch (learned_from) {
         case AnnouncementType::LEARNED_FROM_CUSTOMER:
             return true;
             
@@ -272,11 +811,11 @@ bool BGPSimulator::can_export(const Route& route, RelationType export_relationsh
     return false;
 }
 
-bool BGPSimulator::better_route(const Route& new_route, const Route& existing_route, int deciding_asn) const {
+bool BGPSimulator::better_route(const RibEntry& new_route, const RibEntry& existing_route, int deciding_index) const {
 
     // ROV filtering
-    if (rov_enabled_asns.count(deciding_asn) > 0 && new_route.rov_invalid != existing_route.rov_invalid) {
-        return !new_route.rov_invalid;
+    if (rov_enabled[deciding_index] && new_route.rov_invalid() != existing_route.rov_invalid()) {
+        return !new_route.rov_invalid();
     }
     
     // Relationship preference
@@ -290,170 +829,357 @@ bool BGPSimulator::better_route(const Route& new_route, const Route& existing_ro
     }
     
     // AS path length
-    if (new_route.as_path.size() != existing_route.as_path.size()) {
-        return new_route.as_path.size() < existing_route.as_path.size();
+    if (new_route.path_length != existing_route.path_length) {
+        return new_route.path_length < existing_route.path_length;
     }
     
     // Tie-breaker: next-hop ASN
-    int new_next_hop = (new_route.as_path.size() >= 2) ? new_route.as_path[1] : new_route.as_path[0];
-    int existing_next_hop = (existing_route.as_path.size() >= 2) ? existing_route.as_path[1] : existing_route.as_path[0];
-    
-    bool result = new_next_hop < existing_next_hop;
+    bool result = new_route.next_hop_asn < existing_route.next_hop_asn;
     
     
     return result;
 }
 
-void BGPSimulator::send_route_to_neighbor(int sender_asn, int receiver_asn,
-                                          const Route& route, RelationType relationship) {
-
-    if (std::find(route.as_path.begin(), route.as_path.end(), receiver_asn) != route.as_path.end()) {
-        return;
+bool BGPSimulator::make_offer(int sender_index, int receiver_index, uint32_t prefix_id,
+                              RelationType relationship, RibEntry& offer) const {
+    const RibEntry& route = ribs[prefix_id][sender_index];
+    if (!route.valid() || !can_export(route.announcement_type, relationship)) {
+        return false;
+    }
+    
+    int receiver_asn = graph.index_to_asn[receiver_index];
+    if (route.route->path_contains(receiver_asn)) {
+        return false;
+    }
+    
+    // ROV check: ROV-enabled ASNs drop invalid routes on arrival
+    if (rov_enabled[receiver_index] && route.rov_invalid()) {
+        return false;
     }
+    
+    offer.route = route.route;
+    offer.next_hop_asn = route.route->asn;
+    offer.path_length = route.path_length + 1;
+    offer.announcement_type = relationship_to_announcement_type(relationship);
+    offer.flags = route.flags & (RibEntry::VALID | RibEntry::ROV_INVALID);
+    return true;
+}
 
-    if (!can_export(route, relationship)) {
-        return;
+bool BGPSimulator::best_offer(int index, uint32_t prefix_id, RelationType relationship, RibEntry& best) const {
+    best = ribs[prefix_id][index];
+    bool improved = false;
+    RibEntry offer;
+    for (int sender : graph.neighbors_of(index, reverse_relationship(relationship))) {
+        if (make_offer(sender, index, prefix_id, relationship, offer) &&
+            (!best.valid() || better_route(offer, best, index))) {
+            best = offer;
+            improved = true;
+        }
     }
+    return improved;
+}
 
-    Route sent_route = route.copy();
-    sent_route.prepend(receiver_asn);
-    sent_route.announcement_type = relationship_to_announcement_type(relationship);
+void BGPSimulator::install_route(int index, uint32_t prefix_id, const RibEntry& offer, Sweep& sweep) {
+    RibEntry& rib = ribs[prefix_id][index];
+    sweep.added_routes += !rib.valid();
+    rib = offer;
+    rib.route = sweep.routes.create(offer.route, graph.index_to_asn[index], offer.announcement_type);
+}
 
-    message_queues[receiver_asn][route.prefix].push_back(std::make_shared<Route>(sent_route));
+bool BGPSimulator::propagate() {
+    std::vector<uint32_t> all_prefixes(prefixes.size());
+    for (uint32_t prefix_id = 0; prefix_id < all_prefixes.size(); prefix_id++) {
+        all_prefixes[prefix_id] = prefix_id;
+    }
+    return propagate_prefixes(all_prefixes);
 }
 
-void BGPSimulator::process_messages(int asn) {
-    auto queue_it = message_queues.find(asn);
-    if (queue_it == message_queues.end()) {
-        return;
+bool BGPSimulator::propagate_prefixes(const std::vector<uint32_t>& prefix_ids) {
+    std::cout << "Starting BGP propagation...\n";
+    sync_with_graph();
+    if (!flatten_graph()) {
+        return false;
     }
     
-    for (const auto& prefix_entry : queue_it->second) {
-        const std::string& prefix = prefix_entry.first;
-        const auto& routes = prefix_entry.second;
-        
-        for (const auto& route : routes) {
-            // ROV check: drop invalid routes at ROV-enabled ASNs
-            if (rov_enabled_asns.count(asn) > 0 && route->rov_invalid) {
-                continue;
-            }
-            
-            auto rib_it = ribs.find(asn);
-            if (rib_it == ribs.end() || rib_it->second.find(prefix) == rib_it->second.end()) {
-                ribs[asn][prefix] = route;
-            } else {
-                auto existing_route = rib_it->second[prefix];
-                if (better_route(*route, *existing_route, asn)) {
-                    ribs[asn][prefix] = route;
-                }
-            }
+    // Prefixes never interact, so with enough of them each worker runs the
+    // whole propagation on its own share; with fewer prefixes than threads the
+    // workers split every rank instead
+    bool split_ranks = num_threads > 1 && prefix_ids.size() < num_threads;
+    size_t num_workers = split_ranks ? num_threads
+                                     : std::max<size_t>(1, std::min<size_t>(num_threads, prefix_ids.size()));
+    if (arenas.size() < num_workers) {
+        arenas.resize(num_workers);
+    }
+    
+    // Past this point the only heap calls should be new arena blocks, each
+    // worker's peer-phase list (and, with several workers, their threads and
+    // prefix lists)
+    auto arena_totals = [&](size_t& routes, size_t& blocks, size_t& heap_calls) {
+        routes = blocks = heap_calls = 0;
+        for (const auto& arena : arenas) {
+            routes += arena.size();
+            blocks += arena.allocated_blocks();
+            heap_calls += arena.heap_calls();
+        }
+    };
+    size_t routes_before, blocks_before, arena_calls_before;
+    arena_totals(routes_before, blocks_before, arena_calls_before);
+    uint64_t allocations_before = heap_allocations();
+    
+    if (num_workers == 1) {
+        Sweep sweep{prefix_ids, arenas.front(), true};
+        run_sweeps(sweep);
+        route_count += sweep.added_routes;
+    } else if (split_ranks) {
+        std::cout << "Propagating " << prefix_ids.size() << " prefixes with each rank split across "
+                  << num_workers << " threads...\n";
+        RankSync sync(num_workers);
+        std::vector<Sweep> sweeps;
+        for (unsigned w = 0; w < num_workers; w++) {
+            sweeps.push_back({prefix_ids, arenas[w], w == 0, &sync, w, unsigned(num_workers)});
+        }
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < num_workers; w++) {
+            workers.emplace_back([&, w]() {
+                run_sweeps(sweeps[w]);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (const Sweep& sweep : sweeps) {
+            route_count += sweep.added_routes;
+        }
+    } else {
+        std::cout << "Propagating " << prefix_ids.size() << " prefixes on " << num_workers << " threads...\n";
+        std::vector<std::vector<uint32_t>> shares(num_workers);
+        for (size_t i = 0; i < prefix_ids.size(); i++) {
+            shares[i % num_workers].push_back(prefix_ids[i]);
+        }
+        std::vector<Sweep> sweeps;
+        for (size_t w = 0; w < num_workers; w++) {
+            sweeps.push_back({shares[w], arenas[w], false});
         }
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < num_workers; w++) {
+            workers.emplace_back([&, w]() {
+                run_sweeps(sweeps[w]);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (const Sweep& sweep : sweeps) {
+            route_count += sweep.added_routes;
+        }
+        std::cout << "  Total routes: " << route_count << "\n";
+        std::cout << "BGP converged on every thread!\n";
     }
     
-    message_queues[asn].clear();
+    size_t routes, blocks, arena_calls;
+    arena_totals(routes, blocks, arena_calls);
+    std::cout << "Route arenas: " << routes << " routes in " << blocks
+              << " blocks; propagation made " << heap_allocations() - allocations_before
+              << " heap allocations, " << arena_calls - arena_calls_before
+              << " of them for arena blocks\n";
+    return true;
 }
 
-bool BGPSimulator::propagate() {
-    std::cout << "Starting BGP propagation...\n";
-    flatten_graph();
+namespace {
+
+// The part of [0, size) that worker decides: contiguous, so workers never
+// write the same cache lines of a RIB
+std::pair<size_t, size_t> worker_slice(size_t size, unsigned worker, unsigned num_workers) {
+    return {size * worker / num_workers, size * (worker + 1) / num_workers};
+}
+
+} // namespace
+
+// One ordered UP/ACROSS/DOWN sweep over the worker's prefixes. Every AS
+// pulls its neighbors' current routes instead of being sent them, so each
+// decision only writes the AS's own RIB entry and rank-parallel workers just
+// meet at a barrier after each rank.
+//
+// One sweep is stable, so nothing is ever re-sent. UP installs only
+// customer routes, and every neighbor that could take one (providers
+// above, peers, customers) pulls later in the sweep. ACROSS and DOWN
+// install peer and provider routes, which go only to customers, and
+// customers pull in DOWN after them. The earlier phases never owe a route
+// that a later phase installs. Customer routes are preferred and an ROV AS
+// never holds an invalid route, so a later phase never replaces a route
+// that an earlier phase already passed on.
+void BGPSimulator::run_sweeps(Sweep& sweep) {
+    int num_ranks = graph.num_ranks();
+    // Sized once for the worst case: every AS in this worker's slice
+    std::vector<PendingRoute> pending;
+    auto [first, last] = worker_slice(graph.num_ases(), sweep.worker, sweep.num_workers);
+    pending.reserve(last - first);
     
-    int iteration = 0;
-    int prev_total_routes = 0;
+    if (sweep.verbose) std::cout << "Iteration 1:\n";
     
-    while (true) {
-        iteration++;
-        std::cout << "Iteration " << iteration << ":\n";
-        
-        // Phase 1: Customers send to providers (UP)
-        std::cout << "  Phase 1: Propagating to providers...\n";
-        for (int rank = 0; rank < (int)rank_to_asns.size(); ++rank) {
-            // send from this rank
-            for (int asn : rank_to_asns[rank]) {
-                auto rib_it = ribs.find(asn);
-                if (rib_it != ribs.end()) {
-                    for (const auto& [prefix, routePtr] : rib_it->second) {
-                        const Route& route = *routePtr;
-                        for (const auto& [nbr_asn, rel] : graph.get_neighbors(asn)) {
-                            if (rel == RelationType::CUSTOMER_TO_PROVIDER) {
-                                send_route_to_neighbor(asn, nbr_asn, route, rel);
-                            }
-                        }
-                    }
-                }
-            }
-            // process the **next** rank (providers)
-            if (rank + 1 < (int)rank_to_asns.size()) {
-                for (int asn : rank_to_asns[rank + 1]) {
-                    process_messages(asn);
-                }
+    // Phase 1: Providers pull from customers (UP), bottom rank first so
+    // every customer has already decided
+    if (sweep.verbose) std::cout << "  Phase 1: Propagating to providers...\n";
+    for (int rank = 1; rank < num_ranks; ++rank) {
+        pull_rank(sweep, rank, RelationType::CUSTOMER_TO_PROVIDER);
+    }
+    
+    // Phase 2: Peers pull from peers, all from the post-UP RIBs
+    if (sweep.verbose) std::cout << "  Phase 2: Propagating to peers...\n";
+    for (uint32_t prefix_id : sweep.prefix_ids) {
+        pull_from_peers(sweep, prefix_id, pending);
+    }
+    
+    // Phase 3: Customers pull from providers (DOWN), top rank first
+    if (sweep.verbose) std::cout << "  Phase 3: Propagating to customers...\n";
+    for (int rank = num_ranks - 2; rank >= 0; --rank) {
+        pull_rank(sweep, rank, RelationType::PROVIDER_TO_CUSTOMER);
+    }
+    
+    // route_count still holds what the RIBs had before this sweep
+    int total_routes = route_count + sum_over_workers(sweep, sweep.added_routes);
+    if (sweep.verbose) {
+        std::cout << "  Total routes: " << total_routes << "\n";
+        std::cout << "BGP converged after 1 iteration!\n";
+    }
+}
+
+// Lets this worker's slice of rank pick the best route its neighbors across
+// relationship offer. Those neighbors sit in ranks already decided this phase.
+void BGPSimulator::pull_rank(Sweep& sweep, int rank, RelationType relationship) {
+    IndexRange members = graph.rank_members(rank);
+    auto [first, last] = worker_slice(members.size(), sweep.worker, sweep.num_workers);
+    RibEntry best;
+    for (uint32_t prefix_id : sweep.prefix_ids) {
+        for (size_t i = first; i < last; i++) {
+            int index = members.begin()[i];
+            if (best_offer(index, prefix_id, relationship, best)) {
+                install_route(index, prefix_id, best, sweep);
             }
         }
-        
-        // Phase 2: Peers send to peers  
-        std::cout << "  Phase 2: Propagating to peers...\n";
-        for (int rank = 0; rank < static_cast<int>(rank_to_asns.size()); rank++) {
-            for (int asn : rank_to_asns[rank]) {
-                auto rib_it = ribs.find(asn);
-                if (rib_it != ribs.end()) {
-                    for (const auto& route_entry : rib_it->second) {
-                        const auto& route = route_entry.second;
-                        for (const auto& neighbor : graph.get_neighbors(asn)) {
-                            if (neighbor.second == RelationType::PEER_TO_PEER) {
-                                send_route_to_neighbor(asn, neighbor.first, *route, neighbor.second);
-                            }
-                        }
-                    }
-                }
-            }
-            for (int asn : rank_to_asns[rank]) {
-                process_messages(asn);
+    }
+    wait_for_workers(sweep);
+}
+
+// Peers form no hierarchy, so every AS in this worker's slice chooses first
+// and the winners are installed only after all workers have chosen
+void BGPSimulator::pull_from_peers(Sweep& sweep, uint32_t prefix_id, std::vector<PendingRoute>& pending) {
+    auto [first, last] = worker_slice(graph.num_ases(), sweep.worker, sweep.num_workers);
+    pending.clear();
+    RibEntry best;
+    for (size_t index = first; index < last; index++) {
+        if (best_offer(index, prefix_id, RelationType::PEER_TO_PEER, best)) {
+            pending.push_back({static_cast<int>(index), best});
+        }
+    }
+    wait_for_workers(sweep);
+    for (const auto& chosen : pending) {
+        install_route(chosen.index, prefix_id, chosen.offer, sweep);
+    }
+    wait_for_workers(sweep);
+}
+
+void BGPSimulator::wait_for_workers(const Sweep& sweep) {
+    if (sweep.sync != nullptr) {
+        sweep.sync->barrier.arrive_and_wait();
+    }
+}
+
+// Total of value across rank-parallel workers, the same on every one
+int BGPSimulator::sum_over_workers(const Sweep& sweep, int value) {
+    if (sweep.sync == nullptr) {
+        return value;
+    }
+    sweep.sync->worker_values[sweep.worker] = value;
+    wait_for_workers(sweep);
+    int total = 0;
+    for (int count : sweep.sync->worker_values) {
+        total += count;
+    }
+    wait_for_workers(sweep);
+    return total;
+}
+
+bool BGPSimulator::apply_topology_update(const TopologyDiff& diff) {
+    std::vector<char> affected(prefixes.size(), 0);
+    
+    // A removed edge invalidates every route whose next hop crossed it
+    auto routes_via = [&](int index, int next_hop_asn) {
+        for (size_t prefix_id = 0; prefix_id < ribs.size(); prefix_id++) {
+            const RibEntry& route = ribs[prefix_id][index];
+            if (route.valid() && route.path_length >= 2 && route.next_hop_asn == next_hop_asn) {
+                affected[prefix_id] = 1;
             }
         }
-        
-        // Phase 3: Providers send to customers (DOWN)
-        std::cout << "  Phase 3: Propagating to customers...\n";
-        for (int rank = (int)rank_to_asns.size() - 1; rank >= 0; --rank) {
-            // send from this rank
-            for (int asn : rank_to_asns[rank]) {
-                auto rib_it = ribs.find(asn);
-                if (rib_it != ribs.end()) {
-                    for (const auto& [prefix, routePtr] : rib_it->second) {
-                        const Route& route = *routePtr;
-                        for (const auto& [nbr_asn, rel] : graph.get_neighbors(asn)) {
-                            if (rel == RelationType::PROVIDER_TO_CUSTOMER) {
-                                send_route_to_neighbor(asn, nbr_asn, route, rel);
-                            }
-                        }
-                    }
-                }
+    };
+    for (const auto& rel : diff.removed) {
+        int index1 = graph.index_of(rel.asn1);
+        int index2 = graph.index_of(rel.asn2);
+        if (index1 < 0 || index2 < 0) continue;
+        routes_via(index1, rel.asn2);
+        routes_via(index2, rel.asn1);
+    }
+    
+    graph.apply_diff(diff);
+    sync_with_graph();
+    
+    // An added edge matters if one end now offers the other a route it prefers;
+    // otherwise the converged state is still stable on the new topology
+    auto offers_better = [&](int sender, int receiver, RelationType relationship) {
+        for (uint32_t prefix_id = 0; prefix_id < ribs.size(); prefix_id++) {
+            RibEntry offered;
+            if (affected[prefix_id] || !make_offer(sender, receiver, prefix_id, relationship, offered)) {
+                continue;
             }
-            // process the **previous** rank (customers)
-            if (rank > 0) {
-                for (int asn : rank_to_asns[rank - 1]) {
-                    process_messages(asn);
-                }
+            const RibEntry& existing = ribs[prefix_id][receiver];
+            if (!existing.valid() || better_route(offered, existing, receiver)) {
+                affected[prefix_id] = 1;
             }
         }
-        
-        int total_routes = 0;
-        for (const auto& asn_entry : ribs) {
-            total_routes += asn_entry.second.size();
+    };
+    for (const auto& rel : diff.added) {
+        int index1 = graph.index_of(rel.asn1);
+        int index2 = graph.index_of(rel.asn2);
+        offers_better(index1, index2, rel.rel_type);
+        offers_better(index2, index1, reverse_relationship(rel.rel_type));
+    }
+    
+    std::vector<uint32_t> rerun;
+    for (uint32_t prefix_id = 0; prefix_id < affected.size(); prefix_id++) {
+        if (affected[prefix_id]) {
+            rerun.push_back(prefix_id);
         }
-        
-        std::cout << "  Total routes: " << total_routes << "\n";
-        
-        if (total_routes == prev_total_routes) {
-            std::cout << "BGP converged after " << iteration << " iterations!\n";
-            return true;
+    }
+    std::cout << "Topology update: +" << diff.added.size() << " / -" << diff.removed.size()
+              << " relationships, " << rerun.size() << " prefixes to re-propagate\n";
+    if (rerun.empty()) {
+        return true;
+    }
+    
+    // Unaffected prefixes keep their converged routes; the affected ones are
+    // cleared and rerun from their seeds
+    for (uint32_t prefix_id : rerun) {
+        for (const RibEntry& entry : ribs[prefix_id]) {
+            route_count -= entry.valid();
         }
-        
-        prev_total_routes = total_routes;
-        
-        if (iteration >= 20) {
-            std::cout << "Error: BGP propagation did not converge after 20 iterations - possible routing cycle detected!\n";
-            return false;
+        ribs[prefix_id].assign(graph.num_ases(), RibEntry());
+    }
+    // The cleared routes stay in the arenas until they are compacted; doing
+    // it only once they outnumber the live ones keeps the copying amortized
+    size_t arena_routes = 0;
+    for (const auto& arena : arenas) {
+        arena_routes += arena.size();
+    }
+    if (arena_routes > 2 * size_t(route_count)) {
+        compact_routes();
+    }
+    for (const auto& announcement : announcements) {
+        if (affected[prefixes.intern(announcement.prefix)]) {
+            install_seed(announcement);
         }
     }
+    
+    return propagate_prefixes(rerun);
 }
 
 void BGPSimulator::export_ribs_csv(const std::string& filename) const {
@@ -464,41 +1190,61 @@ void BGPSimulator::export_ribs_csv(const std::string& filename) const {
     
     file << "asn,prefix,as_path\n";
     
-    std::vector<std::tuple<int, std::string, std::string>> entries;
+    // An AS holds at most one route per prefix, so (asn, prefix text) orders
+    // the rows on its own; sort compact keys and write paths straight from
+    // the path tree instead of building every row as strings first
+    std::vector<uint32_t> by_text(prefixes.size());
+    for (uint32_t prefix_id = 0; prefix_id < by_text.size(); prefix_id++) {
+        by_text[prefix_id] = prefix_id;
+    }
+    std::sort(by_text.begin(), by_text.end(), [&](uint32_t a, uint32_t b) {
+        return prefixes.text(a) < prefixes.text(b);
+    });
+    std::vector<uint32_t> text_rank(prefixes.size());
+    for (uint32_t rank = 0; rank < by_text.size(); rank++) {
+        text_rank[by_text[rank]] = rank;
+    }
     
-    for (const auto& asn_entry : ribs) {
-        int asn = asn_entry.first;
-        for (const auto& route_entry : asn_entry.second) {
-            const std::string& prefix = route_entry.first;
-            const auto& route = route_entry.second;
-            
-            std::ostringstream path_ss;
-            path_ss << "(";
-            for (size_t i = 0; i < route->as_path.size(); i++) {
-                if (i > 0) path_ss << ", ";
-                path_ss << route->as_path[i];
-            }
-            if (route->as_path.size() == 1) {
-                path_ss << ",";
+    struct Row {
+        int asn;
+        uint32_t text_rank;
+        uint32_t prefix_id;
+        int index;
+    };
+    std::vector<Row> rows;
+    for (uint32_t prefix_id = 0; prefix_id < ribs.size(); prefix_id++) {
+        for (size_t index = 0; index < ribs[prefix_id].size(); index++) {
+            if (ribs[prefix_id][index].valid()) {
+                rows.push_back({graph.index_to_asn[index], text_rank[prefix_id], prefix_id, static_cast<int>(index)});
             }
-            path_ss << ")";
-            std::string path_str = path_ss.str();
-            
-            entries.push_back(std::make_tuple(asn, prefix, path_str));
         }
     }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        if (a.asn != b.asn) return a.asn < b.asn;
+        return a.text_rank < b.text_rank;
+    });
     
-    std::sort(entries.begin(), entries.end());
-    
-    for (const auto& entry : entries) {
-        file << std::get<0>(entry) << "," << std::get<1>(entry) << ",\"" << std::get<2>(entry) << "\"\n";
+    std::string line;
+    for (const Row& row : rows) {
+        const Route* node = ribs[row.prefix_id][row.index].route;
+        line.clear();
+        line += std::to_string(row.asn);
+        line += ',';
+        line += prefixes.text(row.prefix_id);
+        line += ",\"(";
+        line += std::to_string(node->asn);
+        if (!node->parent) {
+            line += ',';
+        }
+        for (node = node->parent; node != nullptr; node = node->parent) {
+            line += ", ";
+            line += std::to_string(node->asn);
+        }
+        line += ")\"\n";
+        file << line;
     }
 }
 
 int BGPSimulator::get_rib_count() const {
-    int count = 0;
-    for (const auto& asn_entry : ribs) {
-        count += asn_entry.second.size();
-    }
-    return count;
+    return route_count;
 }
\ No newline at end of file
@@ -1,11 +1,14 @@
 #ifndef BGP_SIMULATOR_V2_H
 #define BGP_SIMULATOR_V2_H
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <memory>
+#include <utility>
 
 enum class RelationType {
     PROVIDER_TO_CUSTOMER = 0,  // ASN1 is provider of ASN2
@@ -13,41 +16,281 @@ enum class RelationType {
     CUSTOMER_TO_PROVIDER = 2   // ASN1 is customer of ASN2
 };
 
-enum class AnnouncementType {
+enum class AnnouncementType : uint8_t {
     LEARNED_FROM_CUSTOMER = 0,
     LEARNED_FROM_PEER = 1,
     LEARNED_FROM_PROVIDER = 2
 };
 
-// BGP Route representation
+// An IP prefix in binary form; IPv4 addresses use the first 4 bytes
+struct Prefix {
+    std::array<uint8_t, 16> address{};
+    uint8_t length = 0;
+    bool ipv6 = false;
+    
+    bool operator==(const Prefix& other) const {
+        return address == other.address && length == other.length && ipv6 == other.ipv6;
+    }
+};
+
+struct PrefixHash {
+    size_t operator()(const Prefix& prefix) const;
+};
+
+// Interns prefixes to dense 32-bit IDs. Each prefix is parsed once; its text
+// (first spelling seen) is kept only for output.
+class PrefixTable {
+public:
+    uint32_t intern(const std::string& text);   // throws on a malformed prefix
+    const std::string& text(uint32_t id) const { return texts[id]; }
+    const Prefix& prefix(uint32_t id) const { return prefixes[id]; }
+    size_t size() const { return prefixes.size(); }
+    
+private:
+    std::vector<Prefix> prefixes;
+    std::vector<std::string> texts;
+    std::unordered_map<Prefix, uint32_t, PrefixHash> ids;
+};
+
+// BGP Route representation. AS paths are shared as a parent-pointer tree: a
+// received route is the sender's route plus one ASN, so it keeps a reference
+// to that (immutable) route instead of a private copy of the whole path.
+// Routes live in a RouteArena, which owns them and the tree links between them.
 class Route {
 public:
-    std::string prefix;
-    std::vector<int> as_path;
+    uint32_t prefix_id;                    // ID in the simulator's PrefixTable
+    int asn;                               // AS holding the route, first on the path
+    const Route* parent;                   // route it was learned from, null at the origin
+    uint64_t path_signature;               // Bloom filter of the ASNs on the path
+    uint32_t path_length;
     AnnouncementType announcement_type;
     bool rov_invalid;
     
-    Route(const std::string& prefix, const std::vector<int>& as_path, 
+    // Originated by origin_asn
+    Route(uint32_t prefix_id, int origin_asn,
           AnnouncementType type, bool rov_invalid = false);
+    // parent's route as received by asn: O(1), the path is not copied
+    Route(const Route* parent, int asn, AnnouncementType type);
     
     int get_origin_asn() const;
-    void prepend(int asn);
-    Route copy() const;
+    int next_hop_asn() const { return parent ? parent->asn : asn; }
+    // O(1) when the signature rules asn out; walks the path only on a hit
+    bool path_contains(int asn) const;
+    static uint64_t asn_signature(int asn) {
+        uint64_t hash = static_cast<uint32_t>(asn) * 0x9E3779B97F4A7C15ull;
+        return (uint64_t(1) << (hash >> 58)) | (uint64_t(1) << ((hash >> 52) & 63));
+    }
+};
+
+// Bump allocator for Route nodes. Routes are never freed one by one: blocks
+// of fixed capacity are filled in order and all released together when the
+// arena is destroyed.
+class RouteArena {
+public:
+    template <typename... Args>
+    const Route* create(Args&&... args) {
+        if (blocks.empty() || blocks[current].size() == BLOCK_ROUTES) {
+            next_block();
+        }
+        routes++;
+        return &blocks[current].emplace_back(std::forward<Args>(args)...);
+    }
+    
+    size_t size() const { return routes; }
+    size_t allocated_blocks() const { return blocks.size(); }
+    size_t heap_calls() const { return block_allocations; }   // blocks and block table
+    
+private:
+    static constexpr size_t BLOCK_ROUTES = 1 << 16;
+    
+    void next_block();
+    
+    std::vector<std::vector<Route>> blocks;   // each reserved to BLOCK_ROUTES
+    size_t current = 0;
+    size_t routes = 0;
+    size_t block_allocations = 0;
+};
+
+// One relationship line of a CAIDA file: for PROVIDER_TO_CUSTOMER asn1 is the
+// provider, for PEER_TO_PEER the lower ASN comes first
+struct Relationship {
+    int asn1;
+    int asn2;
+    RelationType rel_type;
+    
+    bool operator<(const Relationship& other) const {
+        if (asn1 != other.asn1) return asn1 < other.asn1;
+        if (asn2 != other.asn2) return asn2 < other.asn2;
+        return rel_type < other.rel_type;
+    }
+    bool operator==(const Relationship& other) const {
+        return asn1 == other.asn1 && asn2 == other.asn2 && rel_type == other.rel_type;
+    }
+};
+
+// Edges that turn one topology snapshot into another
+struct TopologyDiff {
+    std::vector<Relationship> added;
+    std::vector<Relationship> removed;
+    
+    bool empty() const { return added.empty() && removed.empty(); }
+};
+
+// Dense-index layouts ASGraph::renumber() can switch to. INPUT keeps the
+// load order; RANK makes each rank contiguous (ASN order within a rank) so the
+// propagate() phases sweep per-AS arrays sequentially; DEGREE (busiest first)
+// and RCM (reverse Cuthill-McKee) are there for comparison.
+enum class ASOrdering {
+    INPUT,
+    RANK,
+    DEGREE,
+    RCM
+};
+
+// Non-owning view of a run of dense AS indices inside ASGraph's flat arrays
+// (a CSR neighbor range or one rank). Valid until the graph next changes.
+class IndexRange {
+public:
+    IndexRange(const int* first, const int* last) : first(first), last(last) {}
+    
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    
+private:
+    const int* first;
+    const int* last;
 };
 
 // AS Graph representation
+//
+// ASes are numbered densely 0..N-1 (by ascending ASN when loaded from a file,
+// then in order of first appearance). Adjacency is stored as compressed
+// sparse rows split by relationship: each AS owns three consecutive ranges of
+// neighbors (its customers, then its peers, then its providers), so every
+// propagation phase reads exactly the edges it needs. add_relationship() only
+// records the edge; finalize() folds recorded edges into the CSR arrays and
+// keeps every range sorted by neighbor ASN.
 class ASGraph {
 public:
-    // adjacency list: asn -> list of (neighbor_asn, relationship_type)
-    std::unordered_map<int, std::vector<std::pair<int, RelationType>>> adjacency;
-    std::unordered_set<int> all_asns;
+    std::vector<int> index_to_asn;
+    std::unordered_map<int, int> asn_to_index;
+    
+    // Range r of AS i (r = RelationType seen from i, so PROVIDER_TO_CUSTOMER
+    // lists i's customers) is neighbors[offsets[3*i + r] .. offsets[3*i + r + 1])
+    std::vector<uint32_t> offsets{0};
+    std::vector<int> neighbors;
+    
+    // Provider hierarchy, rank 0 holding ASes without customers: rank r is
+    // ranked_asns[rank_offsets[r] .. rank_offsets[r + 1]) and index_to_rank is
+    // the inverse. Computed once per graph and reused by every simulation (and
+    // carried by snapshots); topology changes clear ranks_valid.
+    std::vector<uint32_t> rank_offsets{0};
+    std::vector<int> ranked_asns;
+    std::vector<int> index_to_rank;
+    bool ranks_valid = false;
+    
+    size_t num_ases() const { return index_to_asn.size(); }
+    int index_of(int asn) const;   // -1 if the ASN is unknown
+    int add_asn(int asn);          // index of asn, adding it if new
+    
+    // Neighbors of AS index, all of them or only those in one relationship
+    IndexRange neighbors_of(int index) const {
+        return range(3 * index, 3 * index + 3);
+    }
+    IndexRange neighbors_of(int index, RelationType rel) const {
+        int r = 3 * index + static_cast<int>(rel);
+        return range(r, r + 1);
+    }
+    IndexRange customers_of(int index) const {
+        return neighbors_of(index, RelationType::PROVIDER_TO_CUSTOMER);
+    }
+    IndexRange peers_of(int index) const {
+        return neighbors_of(index, RelationType::PEER_TO_PEER);
+    }
+    IndexRange providers_of(int index) const {
+        return neighbors_of(index, RelationType::CUSTOMER_TO_PROVIDER);
+    }
+    
+    size_t num_ranks() const { return rank_offsets.size() - 1; }
+    IndexRange rank_members(size_t rank) const {
+        const int* base = ranked_asns.data();
+        return IndexRange(base + rank_offsets[rank], base + rank_offsets[rank + 1]);
+    }
     
     void add_relationship(int asn1, int asn2, RelationType rel_type);
-    void load_from_file(const std::string& filename);
-    std::vector<std::pair<int, RelationType>> get_neighbors(int asn) const;
+    void finalize();
+    void load_from_file(const std::string& filename, unsigned num_threads = 0);
     void print_stats() const;
 
     bool has_customer_provider_cycle() const;
+    // ASNs of every customer->provider strongly connected component that holds
+    // a cycle, each sorted, ordered by smallest ASN
+    std::vector<std::vector<int>> customer_provider_cycles() const;
+    // Validate-and-rank in one Kahn pass over customer->provider edges. On an
+    // acyclic graph fills the rank arrays and returns no cycles; otherwise some
+    // ASes stay unranked, ranks_valid stays false and the cycles are returned.
+    // Wide ranks are split across up to num_threads workers (0 = one per core);
+    // each rank is sorted by dense index, so the result never depends on it.
+    std::vector<std::vector<int>> compute_ranks(unsigned num_threads = 0);
+    
+    // Snapshot diffing: relationships() lists every edge once, sorted
+    std::vector<Relationship> relationships() const;
+    TopologyDiff diff_to(const ASGraph& next) const;
+    void apply_diff(const TopologyDiff& diff);
+
+    // Dense index renumbering. ordering() returns new_index[old_index];
+    // renumber() applies it to the ASN table, adjacency and ranks, and must
+    // run before a BGPSimulator is attached to the graph.
+    std::vector<int> ordering(ASOrdering order);
+    void renumber(const std::vector<int>& new_index);
+    // Cache misses of one propagate()-style sweep over the current layout,
+    // under a small set-associative cache model (for comparing orderings where
+    // hardware counters are unavailable)
+    uint64_t modelled_sweep_misses() const;
+
+    // Binary .asgraph snapshot: dense ASN table, CSR adjacency and ranks
+    void save_snapshot(const std::string& filename);
+    void load_snapshot(const std::string& filename);
+
+private:
+    IndexRange range(int first_range, int last_range) const {
+        const int* base = neighbors.data();
+        return IndexRange(base + offsets[first_range], base + offsets[last_range]);
+    }
+    
+    struct PendingEdge {
+        int from;
+        int to;
+        RelationType rel_type;
+    };
+    std::vector<PendingEdge> pending_edges;
+};
+
+// One row of an announcements file: origin_asn originates prefix
+struct Announcement {
+    int origin_asn;
+    std::string prefix;
+    bool rov_invalid;
+};
+
+// One AS's route to one prefix in BGPSimulator's dense RIB arrays: the fields
+// the decision process compares, kept inline, plus the path node holding the
+// exact AS path. In a RIB, route is the AS's own node; in an offer it is the
+// sender's, extended only if the offer gets installed.
+struct RibEntry {
+    static constexpr uint8_t VALID = 1;
+    static constexpr uint8_t ROV_INVALID = 2;
+    
+    const Route* route = nullptr;
+    int next_hop_asn = 0;
+    uint32_t path_length = 0;   // as wide as Route::path_length; never wraps
+    AnnouncementType announcement_type = AnnouncementType::LEARNED_FROM_CUSTOMER;
+    uint8_t flags = 0;
+    
+    bool valid() const { return flags & VALID; }
+    bool rov_invalid() const { return flags & ROV_INVALID; }
 };
 
 // BGP Simulator
@@ -55,31 +298,88 @@ class BGPSimulator {
 private:
     ASGraph& graph;
     std::unordered_set<int> rov_enabled_asns;
+    std::vector<char> rov_enabled;  // by AS index, resolved in propagate()
+    
+    PrefixTable prefixes;
+    // Every Route in ribs: seeds in the first arena, and one arena
+    // per propagation worker so workers never share an allocator
+    std::vector<RouteArena> arenas;
+    unsigned num_threads = 1;
     
-    // Local RIBs: asn -> prefix -> route
-    std::unordered_map<int, std::unordered_map<std::string, std::shared_ptr<Route>>> ribs;
+    // Everything below is indexed by prefix ID, then dense AS index
     
-    // Message queues for propagation: asn -> prefix -> list of received routes
-    std::unordered_map<int, std::unordered_map<std::string, std::vector<std::shared_ptr<Route>>>> message_queues;
+    // Local RIBs: each AS's best route to the prefix
+    std::vector<std::vector<RibEntry>> ribs;
+    // Valid entries across all RIBs, kept current by seeding, propagation
+    // and re-propagation instead of being recounted
+    int route_count = 0;
     
-    // Graph flattening for provider hierarchy
-    std::unordered_map<int, int> asn_to_rank;
-    std::vector<std::vector<int>> rank_to_asns;
+    // Everything seeded so far, replayed when a prefix is re-propagated
+    std::vector<Announcement> announcements;
     
     // Helper functions
-    void flatten_graph();
-    bool better_route(const Route& new_route, const Route& existing_route, int deciding_asn) const;
-    bool can_export(const Route& route, RelationType export_relationship) const;
-    void send_route_to_neighbor(int sender_asn, int receiver_asn, const Route& route, RelationType relationship);
-    void process_messages(int asn);
+    void install_seed(const Announcement& announcement);
+    void install_seed(int origin, uint32_t prefix_id, const Announcement& announcement);
+    void resize_ribs();
+    // Moves the routes the RIBs still reach into fresh arenas, dropping the
+    // ones left behind by cleared prefixes
+    void compact_routes();
+    void sync_with_graph();
+    bool flatten_graph();
+    // One propagation worker: the prefixes it covers and the arena its new
+    // routes go to. Prefix-split workers each own their prefixes outright;
+    // rank-parallel workers share them, each deciding its slice of every rank
+    // and meeting the others at the RankSync barrier between ranks.
+    struct RankSync;
+    struct Sweep {
+        const std::vector<uint32_t>& prefix_ids;
+        RouteArena& routes;
+        bool verbose;
+        RankSync* sync = nullptr;   // null when nothing is shared
+        unsigned worker = 0;
+        unsigned num_workers = 1;
+        // Entries this worker filled that were empty before
+        int added_routes = 0;
+    };
+    // A peer route chosen in the ACROSS phase, installed once every AS has
+    // chosen so that all of them pull from the post-UP RIBs
+    struct PendingRoute {
+        int index;
+        RibEntry offer;
+    };
+    bool propagate_prefixes(const std::vector<uint32_t>& prefix_ids);
+    void run_sweeps(Sweep& sweep);
+    void pull_rank(Sweep& sweep, int rank, RelationType relationship);
+    void pull_from_peers(Sweep& sweep, uint32_t prefix_id, std::vector<PendingRoute>& pending);
+    void wait_for_workers(const Sweep& sweep);
+    int sum_over_workers(const Sweep& sweep, int value);
+    bool better_route(const RibEntry& new_route, const RibEntry& existing_route, int deciding_index) const;
+    bool can_export(AnnouncementType learned_from, RelationType export_relationship) const;
+    // What sender_index's route would look like at receiver_index; false if
+    // export rules, loop prevention or ROV filter it out
+    bool make_offer(int sender_index, int receiver_index, uint32_t prefix_id,
+                    RelationType relationship, RibEntry& offer) const;
+    // Best offer from index's neighbors that reach it across relationship
+    // (their view), if it beats index's current route
+    bool best_offer(int index, uint32_t prefix_id, RelationType relationship, RibEntry& best) const;
+    void install_route(int index, uint32_t prefix_id, const RibEntry& offer, Sweep& sweep);
     AnnouncementType relationship_to_announcement_type(RelationType rel_type) const;
     
 public:
     BGPSimulator(ASGraph& graph);
     
     void set_rov_asns(const std::unordered_set<int>& rov_asns);
+    // Worker threads for propagate() (0 = one per core): prefixes are split
+    // across them when there are enough, otherwise each rank is
+    void set_threads(unsigned threads);
     void seed_announcement(int origin_asn, const std::string& prefix, bool rov_invalid = false);
-    bool propagate();  // Returns false if cycle/infinite loop detected
+    // Bulk form for large announcement sets: no per-row logging
+    void seed_announcements(const std::vector<Announcement>& batch);
+    bool propagate();  // Returns false if a customer-provider cycle is detected
+    
+    // Moves the converged RIBs onto the graph with diff applied, re-propagating
+    // only the prefixes whose routes the changed edges can affect
+    bool apply_topology_update(const TopologyDiff& diff);
     void export_ribs_csv(const std::string& filename) const;
     int get_rib_count() const;
 };
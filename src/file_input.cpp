@@ -0,0 +1,338 @@
+#include "file_input.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        length = static_cast<size_t>(st.st_size);
+        if (length == 0) {
+            ::close(fd);
+            return;
+        }
+        void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::madvise(addr, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const char*>(addr);
+            mapped = true;
+            ::close(fd);
+            return;
+        }
+    }
+
+    // Fallback: read the whole stream into an owned buffer
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        owned.insert(owned.end(), chunk, chunk + n);
+    }
+    ::close(fd);
+    if (n < 0) {
+        throw std::runtime_error("Could not read file: " + filename);
+    }
+    bytes = owned.data();
+    length = owned.size();
+}
+
+MappedFile::~MappedFile() {
+    if (mapped) {
+        ::munmap(const_cast<char*>(bytes), length);
+    }
+}
+
+namespace {
+
+enum class Compression { NONE, GZIP, BZIP2 };
+
+Compression detect_compression(const std::string& filename) {
+    unsigned char magic[3] = {};
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+    ssize_t n = ::read(fd, magic, sizeof(magic));
+    ::close(fd);
+
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return Compression::GZIP;
+    }
+    if (n >= 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+        return Compression::BZIP2;
+    }
+    return Compression::NONE;
+}
+
+// Pulls decompressed bytes out of a compressed file
+class Decompressor {
+public:
+    virtual ~Decompressor() = default;
+    // Fills up to capacity bytes; returns 0 once the input is exhausted
+    virtual size_t read(char* buffer, size_t capacity) = 0;
+};
+
+#ifdef HAVE_ZLIB
+class GzipDecompressor : public Decompressor {
+public:
+    explicit GzipDecompressor(const std::string& filename) : filename(filename) {
+        file = gzopen(filename.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        gzbuffer(file, 1 << 17);
+    }
+    ~GzipDecompressor() override { gzclose(file); }
+
+    // gzread also continues through concatenated gzip members
+    size_t read(char* buffer, size_t capacity) override {
+        int n = gzread(file, buffer, static_cast<unsigned>(capacity));
+        if (n < 0) {
+            int error;
+            throw std::runtime_error("Corrupt gzip data in " + filename + ": " + gzerror(file, &error));
+        }
+        if (n == 0) {
+            // A stream cut off mid-member also ends in 0, with Z_BUF_ERROR set
+            int error = Z_OK;
+            gzerror(file, &error);
+            if (error != Z_OK) {
+                throw std::runtime_error("Truncated gzip file: " + filename);
+            }
+        }
+        return static_cast<size_t>(n);
+    }
+
+private:
+    std::string filename;
+    gzFile file;
+};
+#endif
+
+#ifdef HAVE_BZIP2
+class Bzip2Decompressor : public Decompressor {
+public:
+    explicit Bzip2Decompressor(const std::string& filename) : filename(filename) {
+        file = std::fopen(filename.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        BZ2_bzDecompressInit(&stream, 0, 0);
+    }
+    ~Bzip2Decompressor() override {
+        BZ2_bzDecompressEnd(&stream);
+        std::fclose(file);
+    }
+
+    size_t read(char* buffer, size_t capacity) override {
+        stream.next_out = buffer;
+        stream.avail_out = static_cast<unsigned>(capacity);
+
+        while (stream.avail_out > 0) {
+            if (stream.avail_in == 0 && !input_done) {
+                size_t n = std::fread(input, 1, sizeof(input), file);
+                input_done = (n == 0);
+                stream.next_in = input;
+                stream.avail_in = static_cast<unsigned>(n);
+            }
+            if (stream.avail_in == 0 && input_done) {
+                if (mid_stream) {
+                    throw std::runtime_error("Truncated bzip2 file: " + filename);
+                }
+                break;
+            }
+
+            int rc = BZ2_bzDecompress(&stream);
+            if (rc == BZ_STREAM_END) {
+                // Parallel bzip2 tools write several streams back to back
+                char* next_in = stream.next_in;
+                unsigned avail_in = stream.avail_in;
+                char* next_out = stream.next_out;
+                unsigned avail_out = stream.avail_out;
+                BZ2_bzDecompressEnd(&stream);
+                stream = bz_stream();
+                BZ2_bzDecompressInit(&stream, 0, 0);
+                stream.next_in = next_in;
+                stream.avail_in = avail_in;
+                stream.next_out = next_out;
+                stream.avail_out = avail_out;
+                mid_stream = false;
+            } else if (rc == BZ_OK) {
+                mid_stream = true;
+            } else {
+                throw std::runtime_error("Corrupt bzip2 data in " + filename);
+            }
+        }
+        return capacity - stream.avail_out;
+    }
+
+private:
+    std::string filename;
+    std::FILE* file;
+    bz_stream stream = bz_stream();
+    char input[1 << 16];
+    bool input_done = false;
+    bool mid_stream = false;
+};
+#endif
+
+std::unique_ptr<Decompressor> open_decompressor(const std::string& filename, Compression compression) {
+    switch (compression) {
+        case Compression::GZIP:
+#ifdef HAVE_ZLIB
+            return std::make_unique<GzipDecompressor>(filename);
+#else
+            throw std::runtime_error("Reading gzip input needs zlib; rebuild with zlib installed: " + filename);
+#endif
+        case Compression::BZIP2:
+#ifdef HAVE_BZIP2
+            return std::make_unique<Bzip2Decompressor>(filename);
+#else
+            throw std::runtime_error("Reading bzip2 input needs libbz2; rebuild with bzip2 installed: " + filename);
+#endif
+        case Compression::NONE:
+            break;
+    }
+    return nullptr;
+}
+
+// Bounded hand-off of line-aligned blocks from the inflating thread to the parser
+class BlockQueue {
+public:
+    // Blocks while the queue is full; false if the consumer has gone away
+    bool push(std::vector<char> block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return blocks.size() < MAX_QUEUED || cancelled; });
+        if (cancelled) return false;
+        blocks.push_back(std::move(block));
+        changed.notify_all();
+        return true;
+    }
+
+    // Blocks until a block is ready; false at end of input
+    bool pop(std::vector<char>& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return !blocks.empty() || finished; });
+        if (blocks.empty()) {
+            if (error) std::rethrow_exception(error);
+            return false;
+        }
+        block = std::move(blocks.front());
+        blocks.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void finish(std::exception_ptr failure = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        error = failure;
+        changed.notify_all();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        changed.notify_all();
+    }
+
+private:
+    static constexpr size_t MAX_QUEUED = 4;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> blocks;
+    bool finished = false;
+    bool cancelled = false;
+    std::exception_ptr error;
+};
+
+constexpr size_t BLOCK_BYTES = 1 << 20;
+
+// Producer side: inflate into blocks, cutting each after its last newline
+// and carrying the partial line into the next one
+void inflate_blocks(Decompressor& decompressor, BlockQueue& queue) {
+    std::vector<char> carry;
+    while (true) {
+        std::vector<char> block(std::move(carry));
+        size_t used = block.size();
+        block.resize(used + BLOCK_BYTES);
+        size_t n = decompressor.read(block.data() + used, BLOCK_BYTES);
+        block.resize(used + n);
+
+        if (n == 0) {
+            if (!block.empty()) queue.push(std::move(block));
+            return;
+        }
+
+        auto last_newline = std::find(block.rbegin(), block.rend(), '\n');
+        if (last_newline == block.rend()) {
+            carry = std::move(block);  // no complete line yet
+            continue;
+        }
+        size_t cut = block.rend() - last_newline;
+        carry.assign(block.begin() + cut, block.end());
+        block.resize(cut);
+        if (!queue.push(std::move(block))) {
+            return;
+        }
+    }
+}
+
+} // namespace
+
+bool is_compressed_file(const std::string& filename) {
+    return detect_compression(filename) != Compression::NONE;
+}
+
+void for_each_line_block(const std::string& filename,
+                         const std::function<void(const char*, const char*)>& consume) {
+    Compression compression = detect_compression(filename);
+    if (compression == Compression::NONE) {
+        MappedFile file(filename);
+        consume(file.begin(), file.end());
+        return;
+    }
+
+    std::unique_ptr<Decompressor> decompressor = open_decompressor(filename, compression);
+    BlockQueue queue;
+    std::thread producer([&] {
+        try {
+            inflate_blocks(*decompressor, queue);
+            queue.finish();
+        } catch (...) {
+            queue.finish(std::current_exception());
+        }
+    });
+
+    try {
+        std::vector<char> block;
+        while (queue.pop(block)) {
+            consume(block.data(), block.data() + block.size());
+        }
+    } catch (...) {
+        queue.cancel();
+        producer.join();
+        throw;
+    }
+    producer.join();
+}
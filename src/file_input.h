@@ -0,0 +1,56 @@
+#ifndef FILE_INPUT_H
+#define FILE_INPUT_H
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Read-only view of an input file's bytes. Regular files are memory-mapped so
+// parsers can scan them in place; anything mmap refuses (pipes, /dev/stdin)
+// is read into an owned buffer instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+    const char* begin() const { return bytes; }
+    const char* end() const { return bytes + length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<char> owned;
+};
+
+// True if filename starts with a gzip or bzip2 signature
+bool is_compressed_file(const std::string& filename);
+
+// Calls consume(begin, end) on successive blocks of whole lines of filename.
+// A plain file arrives as one mapped block. A gzip or bzip2 file is inflated
+// on a background thread through a small bounded queue, so decompression
+// overlaps whatever consume does; that needs zlib / libbz2 at build time.
+void for_each_line_block(const std::string& filename,
+                         const std::function<void(const char*, const char*)>& consume);
+
+// Calls consume(begin, end) on every line of filename, without its '\n'
+template <typename Consume>
+void for_each_line(const std::string& filename, Consume consume) {
+    for_each_line_block(filename, [&](const char* p, const char* end) {
+        while (p < end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (eol == nullptr) eol = end;
+            consume(p, eol);
+            p = eol + 1;
+        }
+    });
+}
+
+#endif // FILE_INPUT_H
@@ -0,0 +1,217 @@
+#include "bgp_simulator.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+// Cache model for modelled_sweep_misses(): 32 KiB, 8-way, 64-byte lines, LRU
+constexpr size_t LINE_BYTES = 64;
+constexpr size_t NUM_SETS = 64;
+constexpr size_t NUM_WAYS = 8;
+
+// Bytes of simulator state touched per AS, and where each array would live
+constexpr uint64_t STATE_BYTES = sizeof(RibEntry);
+constexpr uint64_t STATE_BASE = uint64_t(1) << 40;
+constexpr uint64_t OFFSETS_BASE = uint64_t(2) << 40;
+constexpr uint64_t NEIGHBORS_BASE = uint64_t(3) << 40;
+
+class CacheModel {
+public:
+    CacheModel() {
+        for (auto& set : sets) {
+            set.fill(NO_LINE);
+        }
+    }
+
+    void touch(uint64_t address) {
+        uint64_t line = address / LINE_BYTES;
+        auto& set = sets[line % NUM_SETS];
+        // Ways are kept most recently used first
+        size_t way = 0;
+        while (way < NUM_WAYS && set[way] != line) {
+            way++;
+        }
+        if (way == NUM_WAYS) {
+            misses++;
+            way = NUM_WAYS - 1;
+        }
+        std::copy_backward(set.begin(), set.begin() + way, set.begin() + way + 1);
+        set[0] = line;
+    }
+
+    uint64_t misses = 0;
+
+private:
+    static constexpr uint64_t NO_LINE = ~uint64_t(0);
+    std::array<std::array<uint64_t, NUM_WAYS>, NUM_SETS> sets;
+};
+
+} // namespace
+
+std::vector<int> ASGraph::ordering(ASOrdering order) {
+    finalize();
+    int n = static_cast<int>(num_ases());
+    std::vector<int> sequence;  // dense indices in their new order
+    sequence.reserve(n);
+
+    switch (order) {
+        case ASOrdering::INPUT:
+            for (int u = 0; u < n; u++) {
+                sequence.push_back(u);
+            }
+            break;
+
+        case ASOrdering::RANK: {
+            if (!ranks_valid && !compute_ranks().empty()) {
+                throw std::runtime_error("Cannot rank-order a graph with customer-provider cycles");
+            }
+            auto by_asn = [&](int a, int b) { return index_to_asn[a] < index_to_asn[b]; };
+            for (size_t rank = 0; rank < num_ranks(); rank++) {
+                size_t first = sequence.size();
+                sequence.insert(sequence.end(), rank_members(rank).begin(), rank_members(rank).end());
+                std::sort(sequence.begin() + first, sequence.end(), by_asn);
+            }
+            break;
+        }
+
+        case ASOrdering::DEGREE:
+            for (int u = 0; u < n; u++) {
+                sequence.push_back(u);
+            }
+            std::sort(sequence.begin(), sequence.end(), [&](int a, int b) {
+                size_t degree_a = neighbors_of(a).size();
+                size_t degree_b = neighbors_of(b).size();
+                if (degree_a != degree_b) return degree_a > degree_b;
+                return index_to_asn[a] < index_to_asn[b];
+            });
+            break;
+
+        case ASOrdering::RCM: {
+            // Cuthill-McKee BFS over the undirected graph, each component
+            // started from its lowest-degree AS, neighbors enqueued by rising
+            // degree; reversed at the end
+            auto by_degree = [&](int a, int b) {
+                size_t degree_a = neighbors_of(a).size();
+                size_t degree_b = neighbors_of(b).size();
+                if (degree_a != degree_b) return degree_a < degree_b;
+                return a < b;
+            };
+            std::vector<int> starts(n);
+            for (int u = 0; u < n; u++) {
+                starts[u] = u;
+            }
+            std::sort(starts.begin(), starts.end(), by_degree);
+
+            std::vector<char> visited(n, 0);
+            for (int start : starts) {
+                if (visited[start]) continue;
+                visited[start] = 1;
+                size_t head = sequence.size();
+                sequence.push_back(start);
+                while (head < sequence.size()) {
+                    int u = sequence[head++];
+                    size_t first = sequence.size();
+                    for (int v : neighbors_of(u)) {
+                        if (!visited[v]) {
+                            visited[v] = 1;
+                            sequence.push_back(v);
+                        }
+                    }
+                    std::sort(sequence.begin() + first, sequence.end(), by_degree);
+                }
+            }
+            std::reverse(sequence.begin(), sequence.end());
+            break;
+        }
+    }
+
+    std::vector<int> new_index(n);
+    for (int i = 0; i < n; i++) {
+        new_index[sequence[i]] = i;
+    }
+    return new_index;
+}
+
+void ASGraph::renumber(const std::vector<int>& new_index) {
+    finalize();
+    size_t n = num_ases();
+    if (new_index.size() != n) {
+        throw std::invalid_argument("Renumbering must cover every AS");
+    }
+
+    std::vector<int> old_index(n, -1);
+    for (size_t u = 0; u < n; u++) {
+        old_index[new_index[u]] = u;
+    }
+
+    std::vector<int> new_asns(n);
+    std::vector<uint32_t> new_offsets{0};
+    std::vector<int> new_neighbors;
+    new_offsets.reserve(3 * n + 1);
+    new_neighbors.reserve(neighbors.size());
+    for (size_t i = 0; i < n; i++) {
+        int old = old_index[i];
+        new_asns[i] = index_to_asn[old];
+        // Ranges stay sorted by neighbor ASN, so only the indices change
+        for (int r = 0; r < 3; r++) {
+            for (uint32_t e = offsets[3 * old + r]; e < offsets[3 * old + r + 1]; e++) {
+                new_neighbors.push_back(new_index[neighbors[e]]);
+            }
+            new_offsets.push_back(new_neighbors.size());
+        }
+    }
+
+    index_to_asn = std::move(new_asns);
+    for (size_t i = 0; i < n; i++) {
+        asn_to_index[index_to_asn[i]] = i;
+    }
+    offsets = std::move(new_offsets);
+    neighbors = std::move(new_neighbors);
+
+    // Ranks keep their members, re-sorted by the new dense index
+    if (ranks_valid) {
+        for (int& member : ranked_asns) {
+            member = new_index[member];
+        }
+        for (size_t rank = 0; rank < num_ranks(); rank++) {
+            std::sort(ranked_asns.begin() + rank_offsets[rank], ranked_asns.begin() + rank_offsets[rank + 1]);
+            for (int member : rank_members(rank)) {
+                index_to_rank[member] = rank;
+            }
+        }
+    }
+}
+
+uint64_t ASGraph::modelled_sweep_misses() const {
+    if (!ranks_valid) {
+        throw std::logic_error("modelled_sweep_misses() needs computed ranks");
+    }
+
+    CacheModel cache;
+    // Deciding AS u: its state, its CSR offsets, then the state of each
+    // neighbor it pulls from
+    auto pull = [&](int u, RelationType rel) {
+        int r = 3 * u + static_cast<int>(rel);
+        cache.touch(STATE_BASE + u * STATE_BYTES);
+        cache.touch(OFFSETS_BASE + r * sizeof(uint32_t));
+        for (uint32_t e = offsets[r]; e < offsets[r + 1]; e++) {
+            cache.touch(NEIGHBORS_BASE + e * sizeof(int));
+            cache.touch(STATE_BASE + neighbors[e] * STATE_BYTES);
+        }
+    };
+
+    // Same visiting order as the three propagate() phases: customers pulled
+    // bottom rank first, peers in index order, providers top rank first
+    size_t ranks = num_ranks();
+    for (size_t rank = 1; rank < ranks; rank++) {
+        for (int u : rank_members(rank)) pull(u, RelationType::PROVIDER_TO_CUSTOMER);
+    }
+    for (int u = 0; u < static_cast<int>(num_ases()); u++) {
+        pull(u, RelationType::PEER_TO_PEER);
+    }
+    for (int rank = static_cast<int>(ranks) - 2; rank >= 0; rank--) {
+        for (int u : rank_members(rank)) pull(u, RelationType::CUSTOMER_TO_PROVIDER);
+    }
+    return cache.misses;
+}
@@ -0,0 +1,185 @@
+#include "bgp_simulator.h"
+#include "file_input.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+// .asgraph layout (native byte order, every section 8-byte aligned):
+//   SnapshotHeader
+//   int32_t  asns[num_asns]              dense index -> ASN
+//   uint64_t offsets[3 * num_asns + 1]   CSR range starts: customers, peers,
+//                                        providers of each AS in turn
+//   uint32_t neighbors[num_edges]        dense neighbor index
+//   uint32_t rank_offsets[num_ranks + 1] row starts into rank_members
+//   uint32_t rank_members[num_ranked]    dense indices, grouped by rank
+namespace {
+
+constexpr char SNAPSHOT_MAGIC[8] = {'A', 'S', 'G', 'R', 'A', 'P', 'H', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t num_asns;
+    uint64_t num_edges;
+    uint64_t num_ranks;
+    uint64_t num_ranked;
+};
+
+size_t aligned(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+}
+
+template <typename T>
+void write_section(std::ofstream& out, const std::vector<T>& values) {
+    size_t bytes = values.size() * sizeof(T);
+    out.write(reinterpret_cast<const char*>(values.data()), bytes);
+    static const char padding[8] = {};
+    out.write(padding, aligned(bytes) - bytes);
+}
+
+// Returns a typed pointer to the next section and advances the cursor.
+// count comes from the file, so it is checked before being multiplied.
+template <typename T>
+const T* read_section(const MappedFile& file, size_t& cursor, uint64_t count) {
+    if (cursor > file.size() || count > (file.size() - cursor) / sizeof(T)) {
+        throw std::runtime_error("Truncated graph snapshot");
+    }
+    size_t bytes = count * sizeof(T);
+    const T* section = reinterpret_cast<const T*>(file.data() + cursor);
+    cursor += aligned(bytes);
+    return section;
+}
+
+} // namespace
+
+void ASGraph::save_snapshot(const std::string& filename) {
+    finalize();
+    if (!ranks_valid && !compute_ranks().empty()) {
+        throw std::runtime_error("Cannot snapshot a graph with customer-provider cycles");
+    }
+
+    const std::vector<int32_t>& asns = index_to_asn;
+    std::vector<uint64_t> wide_offsets(offsets.begin(), offsets.end());
+    std::vector<uint32_t> neighbor_indices(neighbors.begin(), neighbors.end());
+
+    std::vector<uint32_t> rank_members(ranked_asns.begin(), ranked_asns.end());
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(SnapshotHeader);
+    header.num_asns = asns.size();
+    header.num_edges = neighbor_indices.size();
+    header.num_ranks = num_ranks();
+    header.num_ranked = rank_members.size();
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not create graph snapshot: " + filename);
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_section(out, asns);
+    write_section(out, wide_offsets);
+    write_section(out, neighbor_indices);
+    write_section(out, rank_offsets);
+    write_section(out, rank_members);
+    if (!out) {
+        throw std::runtime_error("Failed writing graph snapshot: " + filename);
+    }
+
+    std::cout << "Saved graph snapshot with " << asns.size() << " ASNs and "
+              << num_ranks() << " ranks to " << filename << "\n";
+}
+
+void ASGraph::load_snapshot(const std::string& filename) {
+    MappedFile file(filename);
+
+    if (file.size() < sizeof(SnapshotHeader)) {
+        throw std::runtime_error("Not a graph snapshot: " + filename);
+    }
+    SnapshotHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a graph snapshot: " + filename);
+    }
+    if (header.version != SNAPSHOT_VERSION || header.header_size != sizeof(SnapshotHeader)) {
+        throw std::runtime_error("Unsupported graph snapshot version in " + filename);
+    }
+
+    // Every AS appears in exactly one rank, so there are no more ranks than ASes
+    if (header.num_ranked != header.num_asns || header.num_ranks > header.num_asns) {
+        throw std::runtime_error("Corrupt graph snapshot: " + filename);
+    }
+
+    size_t cursor = aligned(sizeof(SnapshotHeader));
+    const int32_t* file_asns = read_section<int32_t>(file, cursor, header.num_asns);
+    const uint64_t num_ranges = 3 * header.num_asns;
+    const uint64_t* file_offsets = read_section<uint64_t>(file, cursor, num_ranges + 1);
+    const uint32_t* file_neighbors = read_section<uint32_t>(file, cursor, header.num_edges);
+    const uint32_t* file_rank_offsets = read_section<uint32_t>(file, cursor, header.num_ranks + 1);
+    const uint32_t* file_rank_members = read_section<uint32_t>(file, cursor, header.num_ranked);
+
+    if (file_offsets[0] != 0 || file_offsets[num_ranges] != header.num_edges) {
+        throw std::runtime_error("Corrupt graph snapshot: " + filename);
+    }
+
+    index_to_asn.assign(file_asns, file_asns + header.num_asns);
+    asn_to_index.clear();
+    asn_to_index.reserve(header.num_asns);
+    for (uint64_t i = 0; i < header.num_asns; i++) {
+        asn_to_index[file_asns[i]] = i;
+    }
+    for (uint64_t r = 0; r < num_ranges; r++) {
+        if (file_offsets[r] > file_offsets[r + 1]) {
+            throw std::runtime_error("Corrupt graph snapshot: " + filename);
+        }
+    }
+    offsets.assign(file_offsets, file_offsets + num_ranges + 1);
+    neighbors.resize(header.num_edges);
+    for (uint64_t e = 0; e < header.num_edges; e++) {
+        if (file_neighbors[e] >= header.num_asns) {
+            throw std::runtime_error("Corrupt graph snapshot: " + filename);
+        }
+        neighbors[e] = static_cast<int>(file_neighbors[e]);
+    }
+    pending_edges.clear();
+
+    if (file_rank_offsets[0] != 0 || file_rank_offsets[header.num_ranks] != header.num_ranked) {
+        throw std::runtime_error("Corrupt graph snapshot: " + filename);
+    }
+    for (uint64_t r = 0; r < header.num_ranks; r++) {
+        if (file_rank_offsets[r] > file_rank_offsets[r + 1]) {
+            throw std::runtime_error("Corrupt graph snapshot: " + filename);
+        }
+    }
+    rank_offsets.assign(file_rank_offsets, file_rank_offsets + header.num_ranks + 1);
+    ranked_asns.resize(header.num_ranked);
+    index_to_rank.assign(header.num_asns, -1);
+    for (uint64_t r = 0; r < header.num_ranks; r++) {
+        for (uint32_t m = file_rank_offsets[r]; m < file_rank_offsets[r + 1]; m++) {
+            if (file_rank_members[m] >= header.num_asns || index_to_rank[file_rank_members[m]] != -1) {
+                throw std::runtime_error("Corrupt graph snapshot: " + filename);
+            }
+            ranked_asns[m] = static_cast<int>(file_rank_members[m]);
+            index_to_rank[ranked_asns[m]] = r;
+        }
+    }
+    // Propagation relies on every AS sitting above its customers, and
+    // --load-graph skips the cycle check that would otherwise establish it
+    for (uint64_t u = 0; u < header.num_asns; u++) {
+        for (int customer : customers_of(u)) {
+            if (index_to_rank[customer] >= index_to_rank[u]) {
+                throw std::runtime_error("Corrupt graph snapshot: " + filename);
+            }
+        }
+    }
+    ranks_valid = true;
+
+    std::cout << "Loaded graph snapshot with " << header.num_asns << " ASNs and "
+              << header.num_ranks << " ranks from " << filename << "\n";
+}
@@ -1,17 +1,33 @@
 #include "bgp_simulator.h"
+#include "file_input.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <getopt.h>
 #include <cstring>
+#include <charconv>
+#include <string_view>
 
 void print_usage(const char* program_name) {
     std::cerr << "Usage: " << program_name << " [OPTIONS]\n"
               << "\nRequired Options:\n"
               << "  --relationships FILE   Path to AS relationships file (CAIDA format)\n"
               << "  --announcements FILE   Path to announcements CSV file\n"
+              << "                         (both may be gzip or bzip2 compressed)\n"
               << "\nOptional Options:\n"
               << "  --rov-asns FILE        Path to ROV-enabled ASNs file\n"
+              << "  --save-graph FILE      Write the loaded topology to a binary .asgraph snapshot\n"
+              << "                         (--announcements may be omitted to only build it)\n"
+              << "  --load-graph FILE      Load the topology from a .asgraph snapshot instead of\n"
+              << "                         --relationships\n"
+              << "  --update-relationships FILE\n"
+              << "                         After converging, switch to this newer snapshot and\n"
+              << "                         re-propagate only the prefixes its changed edges affect\n"
+              << "  --as-order ORDER       Dense AS layout: rank (default), degree, rcm or input\n"
+              << "  --threads N            Propagate prefixes on N worker threads (0 = one per\n"
+              << "                         core, default 1); output is identical for any N\n"
+              << "  --order-report         Print modelled cache misses of a propagation sweep\n"
+              << "                         under every AS layout\n"
               << "  --help                 Show this help message\n"
               << "\nOutput:\n"
               << "  Creates ribs.csv in the current directory\n"
@@ -21,6 +37,64 @@ void print_usage(const char* program_name) {
               << "                       --rov-asns rov_asns.csv\n";
 }
 
+// Prints each cyclic customer->provider component; true if there were any
+bool report_cycles(const std::vector<std::vector<int>>& cycles) {
+    if (cycles.empty()) {
+        return false;
+    }
+    
+    std::cerr << "Error: customer-provider cycle detected in AS relationships\n";
+    for (const auto& cycle : cycles) {
+        std::cerr << "  Cycle through " << cycle.size() << " ASes:";
+        for (int asn : cycle) {
+            std::cerr << " " << asn;
+        }
+        std::cerr << "\n";
+    }
+    return true;
+}
+
+const char* ordering_name(ASOrdering order) {
+    switch (order) {
+        case ASOrdering::INPUT: return "input";
+        case ASOrdering::RANK: return "rank";
+        case ASOrdering::DEGREE: return "degree";
+        case ASOrdering::RCM: return "rcm";
+    }
+    return "input";
+}
+
+bool parse_ordering(const std::string& name, ASOrdering& order) {
+    for (ASOrdering candidate : {ASOrdering::INPUT, ASOrdering::RANK, ASOrdering::DEGREE, ASOrdering::RCM}) {
+        if (name == ordering_name(candidate)) {
+            order = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Renumbers a copy of the graph under each layout and compares the cache
+// misses a propagation sweep would take
+void report_orderings(const ASGraph& graph) {
+    std::cout << "AS layout report (modelled 32 KiB cache, misses per sweep):\n";
+    uint64_t baseline = 0;
+    for (ASOrdering order : {ASOrdering::INPUT, ASOrdering::RANK, ASOrdering::DEGREE, ASOrdering::RCM}) {
+        ASGraph renumbered = graph;
+        renumbered.renumber(renumbered.ordering(order));
+        uint64_t misses = renumbered.modelled_sweep_misses();
+        if (order == ASOrdering::INPUT) {
+            baseline = misses;
+        }
+        std::cout << "  " << ordering_name(order) << ": " << misses << " misses";
+        if (baseline > 0) {
+            std::cout << " (" << (100 * misses / baseline) << "% of input)";
+        }
+        std::cout << "\n";
+    }
+    std::cout << "\n";
+}
+
 std::unordered_set<int> load_rov_asns(const std::string& filename) {
     std::unordered_set<int> rov_asns;
     std::ifstream file(filename);
@@ -52,48 +126,70 @@ std::unordered_set<int> load_rov_asns(const std::string& filename) {
     return rov_asns;
 }
 
-void load_announcements(BGPSimulator& sim, const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open announcements file: " + filename);
-    }
-    
-    std::string line;
-    // Skip header
-    std::getline(file, line);
+// Parses "seed_asn,prefix,rov_invalid" rows in place; the rov_invalid field
+// counts as set if it mentions True/true/1, like the Python exporter writes it
+std::vector<Announcement> load_announcements(const std::string& filename) {
+    std::vector<Announcement> batch;
+    bool header = true;
+    int line_number = 0;
     
-    int count = 0;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::string seed_asn_str, prefix, rov_invalid_str;
+    // Goes through for_each_line so .gz/.bz2 announcement files stream in directly
+    for_each_line(filename, [&](const char* begin, const char* end) {
+        line_number++;
+        // Skip header
+        if (header) {
+            header = false;
+            return;
+        }
         
-        if (std::getline(iss, seed_asn_str, ',') &&
-            std::getline(iss, prefix, ',') &&
-            std::getline(iss, rov_invalid_str)) {
-            
-            int seed_asn = std::stoi(seed_asn_str);
-            bool rov_invalid = (rov_invalid_str.find("True") != std::string::npos ||
-                               rov_invalid_str.find("true") != std::string::npos ||
-                               rov_invalid_str.find("1") != std::string::npos);
-            
-            sim.seed_announcement(seed_asn, prefix, rov_invalid);
-            count++;
+        const char* asn_end = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+        if (asn_end == nullptr) return;
+        const char* prefix_begin = asn_end + 1;
+        const char* prefix_end = static_cast<const char*>(std::memchr(prefix_begin, ',', end - prefix_begin));
+        if (prefix_end == nullptr || prefix_end + 1 == end) return;
+        std::string_view rov_field(prefix_end + 1, end - prefix_end - 1);
+        
+        const char* p = begin;
+        while (p < asn_end && (*p == ' ' || *p == '\t')) ++p;
+        int seed_asn;
+        auto result = std::from_chars(p, asn_end, seed_asn);
+        if (result.ec != std::errc()) {
+            throw std::runtime_error("Invalid seed ASN on line " + std::to_string(line_number) +
+                                     " of " + filename);
         }
-    }
+        
+        bool rov_invalid = rov_field.find("True") != std::string_view::npos ||
+                           rov_field.find("true") != std::string_view::npos ||
+                           rov_field.find('1') != std::string_view::npos;
+        batch.push_back({seed_asn, std::string(prefix_begin, prefix_end), rov_invalid});
+    });
     
-    std::cout << "Loaded " << count << " announcements\n";
+    std::cout << "Loaded " << batch.size() << " announcements\n";
+    return batch;
 }
 
 int main(int argc, char* argv[]) {
     std::string relationships_file;
     std::string announcements_file;
     std::string rov_asns_file;
+    std::string save_graph_file;
+    std::string load_graph_file;
+    std::string update_relationships_file;
+    ASOrdering as_order = ASOrdering::RANK;
+    bool order_report = false;
+    unsigned num_threads = 1;
     
     // Define long options
     static struct option long_options[] = {
         {"relationships", required_argument, 0, 'r'},
         {"announcements", required_argument, 0, 'a'},
         {"rov-asns",      required_argument, 0, 'v'},
+        {"save-graph",    required_argument, 0, 's'},
+        {"load-graph",    required_argument, 0, 'l'},
+        {"update-relationships", required_argument, 0, 'u'},
+        {"as-order",      required_argument, 0, 'o'},
+        {"order-report",  no_argument,       0, 'R'},
+        {"threads",       required_argument, 0, 't'},
         {"help",          no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -102,7 +198,7 @@ int main(int argc, char* argv[]) {
     int option_index = 0;
     
     // Parse command line arguments
-    while ((opt = getopt_long(argc, argv, "r:a:v:h", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "r:a:v:s:l:u:o:Rt:h", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'r':
                 relationships_file = optarg;
@@ -113,6 +209,35 @@ int main(int argc, char* argv[]) {
             case 'v':
                 rov_asns_file = optarg;
                 break;
+            case 's':
+                save_graph_file = optarg;
+                break;
+            case 'l':
+                load_graph_file = optarg;
+                break;
+            case 'u':
+                update_relationships_file = optarg;
+                break;
+            case 'o':
+                if (!parse_ordering(optarg, as_order)) {
+                    std::cerr << "Error: unknown --as-order " << optarg << "\n\n";
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                order_report = true;
+                break;
+            case 't': {
+                std::string_view value(optarg);
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), num_threads);
+                if (error != std::errc() || end != value.data() + value.size()) {
+                    std::cerr << "Error: --threads expects a number, got " << optarg << "\n\n";
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -123,8 +248,13 @@ int main(int argc, char* argv[]) {
     }
     
     // Validate required arguments
-    if (relationships_file.empty() || announcements_file.empty()) {
-        std::cerr << "Error: --relationships and --announcements are required\n\n";
+    if (relationships_file.empty() == load_graph_file.empty()) {
+        std::cerr << "Error: exactly one of --relationships and --load-graph is required\n\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (announcements_file.empty() && save_graph_file.empty()) {
+        std::cerr << "Error: --announcements is required\n\n";
         print_usage(argv[0]);
         return 1;
     }
@@ -135,20 +265,43 @@ int main(int argc, char* argv[]) {
         std::cout << "==========================================\n\n";
         
         // Load AS graph
-        std::cout << "Loading AS relationships from " << relationships_file << "...\n";
         ASGraph graph;
-        graph.load_from_file(relationships_file);
+        if (!load_graph_file.empty()) {
+            std::cout << "Loading AS graph snapshot from " << load_graph_file << "...\n";
+            graph.load_snapshot(load_graph_file);
+        } else {
+            std::cout << "Loading AS relationships from " << relationships_file << "...\n";
+            graph.load_from_file(relationships_file);
+        }
         graph.print_stats();
         std::cout << "\n";
 
-        // customer–provider cycle detection
-        if (graph.has_customer_provider_cycle()) {
-            std::cerr << "Error: customer-provider cycle detected in AS relationships\n";
+        // customer–provider cycle detection, fused with ranking so the graph is
+        // walked once (snapshots are only written for acyclic graphs, so their
+        // stored ranks already prove there is none)
+        if (load_graph_file.empty() && report_cycles(graph.compute_ranks())) {
             return 1;  // non-zero exit code as your friend described
         }
+
+        // Dense index layout, fixed before the simulator sizes its per-AS state
+        if (order_report) {
+            report_orderings(graph);
+        }
+        if (as_order != ASOrdering::INPUT) {
+            graph.renumber(graph.ordering(as_order));
+        }
+
+        if (!save_graph_file.empty()) {
+            graph.save_snapshot(save_graph_file);
+            std::cout << "\n";
+            if (announcements_file.empty()) {
+                return 0;
+            }
+        }
         
         // Create simulator
         BGPSimulator sim(graph);
+        sim.set_threads(num_threads);
         
         // Load ROV ASNs if provided
         if (!rov_asns_file.empty()) {
@@ -160,7 +313,7 @@ int main(int argc, char* argv[]) {
         
         // Load and seed announcements
         std::cout << "Loading announcements from " << announcements_file << "...\n";
-        load_announcements(sim, announcements_file);
+        sim.seed_announcements(load_announcements(announcements_file));
         std::cout << "\n";
         
         // Run propagation
@@ -172,6 +325,22 @@ int main(int argc, char* argv[]) {
             return 1;  // Non-zero exit code for cycle detection
         }
         
+        // Incremental re-simulation against a newer topology snapshot
+        if (!update_relationships_file.empty()) {
+            std::cout << "Loading updated AS relationships from " << update_relationships_file << "...\n";
+            ASGraph next_graph;
+            next_graph.load_from_file(update_relationships_file);
+            if (report_cycles(next_graph.compute_ranks())) {
+                return 1;
+            }
+            
+            if (!sim.apply_topology_update(graph.diff_to(next_graph))) {
+                std::cerr << "BGP propagation failed due to routing cycles!\n";
+                return 1;
+            }
+            std::cout << "\n";
+        }
+        
         // Export RIBs to ribs.csv in current directory
         std::string output_file = "ribs.csv";
         std::cout << "Exporting RIBs to " << output_file << "...\n";
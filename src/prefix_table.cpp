@@ -0,0 +1,50 @@
+#include "bgp_simulator.h"
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+size_t PrefixHash::operator()(const Prefix& prefix) const {
+    // FNV-1a over the address bytes, length and family
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint8_t byte) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    };
+    for (uint8_t byte : prefix.address) {
+        mix(byte);
+    }
+    mix(prefix.length);
+    mix(prefix.ipv6);
+    return static_cast<size_t>(hash);
+}
+
+uint32_t PrefixTable::intern(const std::string& text) {
+    Prefix prefix;
+
+    size_t slash = text.find('/');
+    if (slash == std::string::npos) {
+        throw std::runtime_error("Invalid prefix: " + text);
+    }
+    std::string address = text.substr(0, slash);
+    prefix.ipv6 = address.find(':') != std::string::npos;
+    if (inet_pton(prefix.ipv6 ? AF_INET6 : AF_INET, address.c_str(), prefix.address.data()) != 1) {
+        throw std::runtime_error("Invalid prefix: " + text);
+    }
+
+    unsigned length = 0;
+    const char* first = text.data() + slash + 1;
+    const char* last = text.data() + text.size();
+    auto [end, error] = std::from_chars(first, last, length);
+    if (error != std::errc() || end != last || first == last || length > (prefix.ipv6 ? 128u : 32u)) {
+        throw std::runtime_error("Invalid prefix: " + text);
+    }
+    prefix.length = static_cast<uint8_t>(length);
+
+    auto [it, inserted] = ids.emplace(prefix, static_cast<uint32_t>(prefixes.size()));
+    if (inserted) {
+        prefixes.push_back(prefix);
+        texts.push_back(text);
+    }
+    return it->second;
+}